@@ -0,0 +1,126 @@
+#include "Log.h"
+
+#include <stdarg.h>
+
+char Log::buffer[Log::BUFFER_SIZE];
+size_t Log::head = 0;
+size_t Log::tail = 0;
+unsigned long Log::dropped = 0;
+unsigned long Log::reportedDropped = 0;
+Log::LinePrint Log::linePrint;
+size_t Log::lineHead = 0;
+bool Log::lineOverflow = false;
+
+void Log::begin(unsigned long baud) {
+    Serial.begin(baud);
+}
+
+void Log::write(char level, const char* format, ...) {
+    char line[LINE_SIZE];
+
+    int length = snprintf(line, LINE_SIZE, "%c ", level);
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + length, LINE_SIZE - length - 2, format, args);
+    va_end(args);
+
+    length = strlen(line);
+    line[length++] = '\r';
+    line[length++] = '\n';
+
+    if (! enqueue(line, length)) {
+        dropped++;
+    }
+}
+
+Print* Log::beginLine() {
+    lineHead = head;
+    lineOverflow = false;
+    return &linePrint;
+}
+
+size_t Log::LinePrint::write(uint8_t c) {
+    // bytes after head aren't sent until endLine() moves it
+    if (lineOverflow || lineHead - tail >= BUFFER_SIZE) {
+        lineOverflow = true;
+        return 0;
+    }
+
+    buffer[lineHead & (BUFFER_SIZE - 1)] = c;
+    lineHead++;
+    return 1;
+}
+
+void Log::endLine() {
+    if (lineOverflow) {
+        dropped++;
+    } else {
+        head = lineHead;
+    }
+}
+
+void Log::flush() {
+    // Report dropped messages as soon as there is room for the report
+    if (dropped != reportedDropped) {
+        char line[48];
+        int length = snprintf(line, sizeof(line), "W log: %lu messages dropped\r\n", dropped - reportedDropped);
+        if (enqueue(line, length)) {
+            reportedDropped = dropped;
+        }
+    }
+
+    // Serial is native USB on the Nano 33 IoT. Without a host reading the port a write waits for the
+    // USB timeout, so nothing is written then; the buffer fills up and further messages are counted as dropped.
+    if (head == tail || ! Serial) {
+        return;
+    }
+
+    // availableForWrite() is the size of the endpoint buffer, not what is free in it:
+    // one packet per loop pass keeps each write short
+    size_t length = head - tail;
+    if (length > FLUSH_CHUNK) {
+        length = FLUSH_CHUNK;
+    }
+
+    // end the chunk with a whole line if one fits, only a line longer than a chunk is split
+    size_t lineEnd = 0;
+    for (size_t i=0; i<length; i++) {
+        if (buffer[(tail + i) & (BUFFER_SIZE - 1)] == '\n') {
+            lineEnd = i + 1;
+        }
+    }
+    if (lineEnd > 0) {
+        length = lineEnd;
+    }
+
+    // copy across the end of the ring buffer, so it goes out in one write
+    uint8_t chunk[FLUSH_CHUNK];
+    for (size_t i=0; i<length; i++) {
+        chunk[i] = buffer[(tail + i) & (BUFFER_SIZE - 1)];
+    }
+    Serial.write(chunk, length);
+    tail += length;
+}
+
+unsigned long Log::getDropped() {
+    return dropped;
+}
+
+size_t Log::getFree() {
+    return BUFFER_SIZE - (head - tail);
+}
+
+bool Log::enqueue(const char* line, size_t length) {
+    // whole messages or nothing, so the output never contains partial lines
+    if (length > getFree()) {
+        return false;
+    }
+
+    for (size_t i=0; i<length; i++) {
+        buffer[(head + i) & (BUFFER_SIZE - 1)] = line[i];
+    }
+    head += length;
+
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are removed by the preprocessor, including their arguments.
+// Set it for all sources at once, e.g. CPPFLAGS += -DLOG_LEVEL=4 in the Makefile.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Log::write('E', __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) Log::write('W', __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) Log::write('I', __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) Log::write('D', __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+class Log {
+public:
+  static void begin(unsigned long baud);
+
+  // Format a message into the ring buffer, drop it if it doesn't fit. Never blocks.
+  static void write(char level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  // Stream one line longer than LINE_SIZE (e.g. a trace record, ending in "\r\n") into the ring buffer.
+  // endLine() queues it as a whole or drops it if it didn't fit; no other messages in between.
+  static Print* beginLine();
+  static void endLine();
+
+  // Move one chunk of the ring buffer to Serial, call it once per loop pass
+  static void flush();
+
+  static unsigned long getDropped();
+
+private:
+  static const size_t BUFFER_SIZE = 2048;  // power of two, holds a trace record of a typical exchange
+  static const size_t LINE_SIZE = 128;     // longer messages are truncated
+  static const size_t FLUSH_CHUNK = 64;    // one USB packet per flush
+
+  static char buffer[BUFFER_SIZE];
+  static size_t head;  // next byte to write
+  static size_t tail;  // next byte to send
+  static unsigned long dropped;
+  static unsigned long reportedDropped;
+
+  class LinePrint : public Print {
+  public:
+    size_t write(uint8_t);
+    using Print::write;
+  };
+  static LinePrint linePrint;
+  static size_t lineHead;     // next byte of the line being streamed
+  static bool lineOverflow;   // the line doesn't fit, drop it at endLine()
+
+  static size_t getFree();
+  static bool enqueue(const char* line, size_t length);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "DeadlineClient.h"
+
+DeadlineClient::DeadlineClient(Client& _client)
+    : client(_client),
+      active(false),
+      start(0),
+      budget(0) {
+}
+
+void DeadlineClient::setDeadline(unsigned long budgetMillis) {
+    active = true;
+    start = millis();
+    budget = budgetMillis;
+}
+
+void DeadlineClient::clearDeadline() {
+    active = false;
+}
+
+bool DeadlineClient::isExpired() {
+    return active && (millis() - start) >= budget;
+}
+
+int DeadlineClient::connect(IPAddress ip, uint16_t port) {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.connect(ip, port);
+}
+
+int DeadlineClient::connect(const char* host, uint16_t port) {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.connect(host, port);
+}
+
+size_t DeadlineClient::write(uint8_t b) {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.write(b);
+}
+
+size_t DeadlineClient::write(const uint8_t* buf, size_t size) {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.write(buf, size);
+}
+
+int DeadlineClient::available() {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.available();
+}
+
+int DeadlineClient::read() {
+    if (isExpired()) {
+        return -1;
+    }
+    return client.read();
+}
+
+int DeadlineClient::read(uint8_t* buf, size_t size) {
+    if (isExpired()) {
+        return -1;
+    }
+    return client.read(buf, size);
+}
+
+int DeadlineClient::peek() {
+    if (isExpired()) {
+        return -1;
+    }
+    return client.peek();
+}
+
+void DeadlineClient::flush() {
+    if (!isExpired()) {
+        client.flush();
+    }
+}
+
+void DeadlineClient::stop() {
+    client.stop();
+}
+
+uint8_t DeadlineClient::connected() {
+    if (isExpired()) {
+        return 0;
+    }
+    return client.connected();
+}
+
+DeadlineClient::operator bool() {
+    return connected();
+}
@@ -0,0 +1,40 @@
+#ifndef _DEADLINE_CLIENT_H_
+#define _DEADLINE_CLIENT_H_
+
+#include <Arduino.h>
+#include <Client.h>
+
+/*
+* Wraps a Client and makes it look disconnected once the current deadline has passed.
+* BearSSL polls the underlying client until data arrives or the connection drops,
+* so this is what bounds the TLS handshake and every read and write on top of it.
+*/
+class DeadlineClient : public Client {
+    public:
+        DeadlineClient(Client& client);
+
+        void setDeadline(unsigned long budgetMillis);
+        void clearDeadline();
+        bool isExpired();
+
+        virtual int connect(IPAddress ip, uint16_t port);
+        virtual int connect(const char* host, uint16_t port);
+        virtual size_t write(uint8_t b);
+        virtual size_t write(const uint8_t* buf, size_t size);
+        virtual int available();
+        virtual int read();
+        virtual int read(uint8_t* buf, size_t size);
+        virtual int peek();
+        virtual void flush();
+        virtual void stop();
+        virtual uint8_t connected();
+        virtual operator bool();
+
+    private:
+        Client& client;
+        bool active;
+        unsigned long start;
+        unsigned long budget;
+};
+
+#endif
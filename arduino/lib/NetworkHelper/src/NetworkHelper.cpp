@@ -1,16 +1,39 @@
 #include "NetworkHelper.h"
 
+#include <utility/wifi_drv.h>
+
 NetworkHelper::NetworkHelper(const char* _backend, const char* _certificate)
     : backend(_backend),
       certificate(_certificate),
+      msgPack(false),
+      budget(&BACKGROUND_BUDGET),
+      lastError(OK),
+      lastStatus(0),
+      circuit(CIRCUIT_CLOSED),
+      failures(0),
+      backoff(BACKOFF_MIN),
+      openedAt(0),
+      retryDelay(0),
+      requestBodyOffset(0),
+      capture(false),
+      captured(true),
       client(),
-      sslClient(client, TAs, TAs_NUM) {
+      deadlineClient(client),
+      sslClient(deadlineClient, TAs, TAs_NUM) {
         sslClient.setEccSlot(0, certificate);
 }
 
 unsigned long NetworkHelper::lastWifiConnectTime = 0;
 unsigned long NetworkHelper::wifiConnectDelay = 10000;
 
+//                                                     connect  send  header  body  drain
+const NetworkBudget NetworkHelper::INTERACTIVE_BUDGET = { 8000, 1000,  3000, 1000,  100 };
+const NetworkBudget NetworkHelper::BACKGROUND_BUDGET  = {12000, 2000,  6000, 3000,  300 };
+
+const int NetworkHelper::CIRCUIT_FAILURE_THRESHOLD = 2;
+const unsigned long NetworkHelper::BACKOFF_MIN = 30000;     // 30 seconds
+const unsigned long NetworkHelper::BACKOFF_MAX = 1800000;   // 30 minutes
+
 #ifdef __arm__
 // should use uinstd.h to define sbrk but Due causes a conflict
 extern "C" char* sbrk(int incr);
@@ -30,15 +53,162 @@ int NetworkHelper::freeMemory() {
 }
 
 static unsigned long NetworkHelper::getTimeCallback() {
-    Serial.print("BearSSL get time from wifi: ");
-    Serial.println(WiFi.getTime());
-    return WiFi.getTime();
+    unsigned long time = WiFi.getTime();
+    LOG_DEBUG("BearSSL get time from wifi: %lu", time);
+    return time;
 }
 
 BearSSLClient* NetworkHelper::getClient() {
     return &sslClient;
 }
 
+void NetworkHelper::setMsgPack(bool m) {
+    msgPack = m;
+}
+
+void NetworkHelper::setBudget(const NetworkBudget* b) {
+    budget = b;
+}
+
+void NetworkHelper::setCapture(bool enabled) {
+    capture = enabled;
+}
+
+NetworkHelper::NetworkError NetworkHelper::getLastError() {
+    return lastError;
+}
+
+NetworkHelper::CircuitState NetworkHelper::getCircuitState() {
+    return circuit;
+}
+
+const char* NetworkHelper::errorName(NetworkError error) {
+    switch (error) {
+        case OK: return "ok";
+        case NO_WIFI: return "no wifi";
+        case NOT_CONNECTED: return "not connected";
+        case CONNECT_FAILED: return "connect failed";
+        case CONNECT_TIMEOUT: return "connect timeout";
+        case REQUEST_TOO_LARGE: return "request too large";
+        case SEND_TIMEOUT: return "send timeout";
+        case HEADER_TIMEOUT: return "header timeout";
+        case BODY_TIMEOUT: return "body timeout";
+        case RESPONSE_TOO_LARGE: return "response too large";
+        case CONNECTION_CLOSED: return "connection closed";
+        case HTTP_STATUS: return "unexpected http status";
+        case INVALID_RESPONSE: return "invalid response";
+        case BACKEND_DOWN: return "backend down, circuit open";
+    }
+    return "unknown";
+}
+
+bool NetworkHelper::fail(NetworkError error) {
+    lastError = error;
+    LOG_WARN("Network error: %s", errorName(error));
+
+    // a failure opens the circuit, an answer closes it, anything else leaves the decision to the next request
+    if (isBackendFailure(error)) {
+        recordFailure();
+    } else if (isBackendAnswer(error)) {
+        recordSuccess();
+    } else {
+        releaseProbe();
+    }
+
+    // A timed out connection is in an unknown state, don't reuse it
+    if (deadlineClient.isExpired()) {
+        sslClient.stop();
+        deadlineClient.clearDeadline();
+    }
+
+    return false;
+}
+
+bool NetworkHelper::isBackendFailure(NetworkError error) {
+    // Only what says something about the backend: no wifi is our problem,
+    // a 4xx status or an unparsable body means the backend is up
+    switch (error) {
+        case CONNECT_FAILED:
+        case CONNECT_TIMEOUT:
+        case SEND_TIMEOUT:
+        case HEADER_TIMEOUT:
+        case BODY_TIMEOUT:
+        case CONNECTION_CLOSED:
+            return true;
+        case HTTP_STATUS:
+            return lastStatus >= 500;
+        default:
+            return false;
+    }
+}
+
+bool NetworkHelper::isBackendAnswer(NetworkError error) {
+    // A complete HTTP response below 500 proves the backend is up, even if we can't use it
+    switch (error) {
+        case HTTP_STATUS:
+            return lastStatus < 500;
+        case RESPONSE_TOO_LARGE:
+        case INVALID_RESPONSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool NetworkHelper::allowRequest() {
+    if (circuit == CIRCUIT_CLOSED) {
+        return true;
+    }
+    // only one trial at a time, the others fail at once until it decided
+    if (circuit == CIRCUIT_HALF_OPEN) {
+        return false;
+    }
+    if (millis() - openedAt < retryDelay) {
+        return false;
+    }
+
+    // backoff passed: let one trial through
+    LOG_INFO("Circuit half open, trying backend");
+    circuit = CIRCUIT_HALF_OPEN;
+    return true;
+}
+
+void NetworkHelper::recordSuccess() {
+    if (circuit != CIRCUIT_CLOSED) {
+        LOG_INFO("Circuit closed, backend is back");
+    }
+    circuit = CIRCUIT_CLOSED;
+    failures = 0;
+    backoff = BACKOFF_MIN;
+}
+
+void NetworkHelper::releaseProbe() {
+    // The trial ended without an outcome (no request sent or aborted): the next request is the trial
+    if (circuit == CIRCUIT_HALF_OPEN) {
+        circuit = CIRCUIT_OPEN;
+        retryDelay = 0;
+    }
+}
+
+void NetworkHelper::recordFailure() {
+    failures++;
+
+    if (circuit == CIRCUIT_CLOSED && failures < CIRCUIT_FAILURE_THRESHOLD) {
+        return;
+    }
+
+    // a failed trial doubles the backoff
+    if (circuit == CIRCUIT_HALF_OPEN) {
+        backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
+    }
+
+    // jitter between half and full backoff, so devices don't come back all at once
+    circuit = CIRCUIT_OPEN;
+    openedAt = millis();
+    retryDelay = random(backoff / 2, backoff + 1);
+    LOG_WARN("Circuit open, next try in %lu s", retryDelay / 1000);
+}
+
 static bool NetworkHelper::isWifiConnected() {
     if (WiFi.status() == WL_CONNECTED) {
         return true;
@@ -53,20 +223,22 @@ static bool NetworkHelper::isWifiTimeAvailable() {
     return false;
 }
 
+static unsigned long NetworkHelper::getWifiTime() {
+    // UTC seconds from the NTP client of the wifi module, 0 if it has no time yet
+    return WiFi.getTime();
+}
+
 static void NetworkHelper::connectWifi(const char* ssid, const char* pass) {
     if ( (millis() - wifiConnectDelay) > lastWifiConnectTime) {
         int wifiStatus = WiFi.status();
         lastWifiConnectTime = millis();
         
         if(wifiStatus != WL_CONNECTED) {
-            Serial.println("Not connected to Wifi. Attempting to connect...");
-        
-            wifiStatus = WiFi.begin(ssid, pass);
-        
-            if (wifiStatus == WL_CONNECTED) {
-                Serial.println("Successfully connected to wifi");
-                printWifiStatus();
-            }
+            LOG_INFO("Not connected to Wifi. Attempting to connect...");
+
+            // Only start connecting: WiFi.begin() would poll the status for up to 10 seconds.
+            // The caller keeps checking isWifiConnected() and can do other things meanwhile.
+            WiFiDrv::wifiSetPassphrase(ssid, strlen(ssid), pass, strlen(pass));
         }
     }
 }
@@ -74,50 +246,55 @@ static void NetworkHelper::connectWifi(const char* ssid, const char* pass) {
 static void NetworkHelper::checkWifiFirmware() {
     String fv = WiFi.firmwareVersion();
     if (fv < WIFI_FIRMWARE_LATEST_VERSION) {
-        Serial.println("Please upgrade the firmware");
+        LOG_WARN("Please upgrade the firmware");
     }
 }
 
 static void NetworkHelper::checkWifiModule() {
     if (WiFi.status() == WL_NO_MODULE) {
-        Serial.println("Communication with WiFi module failed!");
-        // don't continue
+        LOG_ERROR("Communication with WiFi module failed!");
+        // don't continue, but let the message out
+        Log::flush();
         while (true);
     }
 }
 
 static void NetworkHelper::printWifiStatus() {
     // print the SSID of the network you're attached to:
-    Serial.print("SSID: ");
-    Serial.println(WiFi.SSID());
+    LOG_INFO("SSID: %s", WiFi.SSID());
 
     // print your board's IP address:
     IPAddress ip = WiFi.localIP();
-    Serial.print("IP Address: ");
-    Serial.println(ip);
+    LOG_INFO("IP Address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
 
     // print the received signal strength:
-    long rssi = WiFi.RSSI();
-    Serial.print("signal strength (RSSI) in dBm:");
-    Serial.println(rssi);
+    LOG_INFO("signal strength (RSSI) in dBm: %ld", WiFi.RSSI());
 }
 
 bool NetworkHelper::connectBackend() {
-    Serial.print("Connecting to Backend: ");
-    Serial.println(backend);
+    LOG_INFO("Connecting to Backend: %s", backend);
+
+    if (!isWifiConnected()) {
+        return fail(NO_WIFI);
+    }
+
+    // an unhealthy backend costs nothing until the next trial
+    if (! allowRequest()) {
+        lastError = BACKEND_DOWN;
+        return false;
+    }
 
     ArduinoBearSSL.onGetTime(&NetworkHelper::getTimeCallback);
+    deadlineClient.setDeadline(budget->connect);
     bool connected = sslClient.connect(backend, 443);
 
-    Serial.print("Connected: ");
-    Serial.println(connected);
-
     if(!connected) {
-        Serial.print("Failed to connect to backend. Error Code ");
-        Serial.println(sslClient.errorCode());
+        LOG_WARN("Failed to connect to backend. Error Code %d", sslClient.errorCode());
+        return fail(deadlineClient.isExpired() ? CONNECT_TIMEOUT : CONNECT_FAILED);
     }
 
-    return connected;
+    lastError = OK;
+    return true;
 }
 
 bool NetworkHelper::getRequest(const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc) {
@@ -133,114 +310,286 @@ bool NetworkHelper::deleteRequest(const char* path, DynamicJsonDocument* request
 }
 
 bool NetworkHelper::httpRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc) {
-    if(sslClient.connected()) {
-        Serial.println("Submitting http request to backend.");
-
-        sslClient.print(method);
-        sslClient.print(" ");
-        sslClient.print(path);
-        sslClient.println(" HTTP/1.1");
-        sslClient.print("Host: ");
-        sslClient.println(backend);
-        sslClient.println("Content-type: application/json");
-        sslClient.println("Accept: */*");
-        sslClient.println("Cache-Control: no-cache");
-        sslClient.println("Accept-Encoding: gzip, deflate");
-        sslClient.print("Content-Length: ");
-        sslClient.println(measureJson(*requestDoc));
-
-        // Terminate header with blank line
-        sslClient.println();
-
-        // Send JSON document in body
-        serializeJson(*requestDoc, Serial);
-        serializeJson(*requestDoc, sslClient);
-
-
-        // Check HTTP status
-        char status[32] = {0};
-        sslClient.readBytesUntil('\r', status, sizeof(status));
-        Serial.println(status);
-        // It should be "HTTP/1.0 200 OK" or "HTTP/1.1 200 CREATED"
-        if ( strcmp(status + 9, "200 OK") != 0 && strcmp(status + 9, "201 CREATED") != 0 ) 
-        {
-            Serial.print(F("Unexpected response: "));
-            Serial.println(status);
-
-            // Catch trailing result
-            while(sslClient.available()) {
-                Serial.write(sslClient.read());
-            }
-            
-            return false;
+    if (! sendRequest(method, path, requestDoc)) {
+        return false;
+    }
+
+    return receiveResponse(responseDoc);
+}
+
+bool NetworkHelper::sendRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc) {
+    if(! sslClient.connected()) {
+        LOG_ERROR("Backend is not connected. Connect before making a request!");
+        return fail(NOT_CONNECTED);
+    }
+
+    size_t requestLength = buildRequest(method, path, requestDoc);
+    if (requestLength == 0) {
+        return fail(REQUEST_TOO_LARGE);
+    }
+
+    LOG_INFO("%s %s (%u bytes)", method, path, requestLength);
+
+    captureMethod = method;
+    capturePath = path;
+    captureRequestLength = requestLength;
+    captureStart = millis();
+    captured = false;
+
+    // Send header and body at once, so they end up in as few TLS records as possible
+    deadlineClient.setDeadline(budget->send);
+    if (sslClient.write((const uint8_t*)requestBuffer, requestLength) != requestLength) {
+        return fail(SEND_TIMEOUT);
+    }
+    sslClient.flush();
+    if (deadlineClient.isExpired()) {
+        return fail(SEND_TIMEOUT);
+    }
+    deadlineClient.clearDeadline();
+
+    lastError = OK;
+    return true;
+}
+
+bool NetworkHelper::isResponseAvailable() {
+    // Encrypted bytes waiting on the socket, or the server gave up: either way reading won't wait long.
+    // Asking the TLS client instead would make it block on the socket.
+    return client.available() > 0 || ! client.connected();
+}
+
+bool NetworkHelper::receiveResponse(DynamicJsonDocument* responseDoc) {
+    if (! readResponse(responseDoc)) {
+        // no complete response: still worth a record with the error
+        if (! captured) {
+            captureExchange(0, NULL, 0, 0);
         }
+        return false;
+    }
+
+    recordSuccess();
+    lastError = OK;
+    return true;
+}
+
+void NetworkHelper::abortRequest() {
+    // Nobody is interested in the answer any more, the connection can't be reused
+    deadlineClient.setDeadline(budget->drain);
+    sslClient.stop();
+    deadlineClient.clearDeadline();
+    releaseProbe();
+}
+
+bool NetworkHelper::isBackendConnected() {
+    return sslClient.connected();
+}
+
+size_t NetworkHelper::buildRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc) {
+    size_t bodyLength = msgPack ? measureMsgPack(*requestDoc) : measureJson(*requestDoc);
+
+    int headerLength = snprintf(requestBuffer, REQUEST_BUFFER_SIZE,
+        "%s %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Content-Type: %s\r\n"
+        "Accept: %s\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Content-Length: %u\r\n"
+        "\r\n",
+        method, path, backend,
+        msgPack ? "application/msgpack" : "application/json",
+        msgPack ? "application/msgpack" : "application/json",
+        bodyLength);
+
+    // serializeJson needs one more byte for the terminating zero
+    if (headerLength < 0 || headerLength + bodyLength + 1 > REQUEST_BUFFER_SIZE) {
+        return 0;
+    }
+
+    requestBodyOffset = headerLength;
+    char* body = requestBuffer + headerLength;
+    size_t bodyCapacity = REQUEST_BUFFER_SIZE - headerLength;
+    if (msgPack) {
+        serializeMsgPack(*requestDoc, body, bodyCapacity);
+    } else {
+        serializeJson(*requestDoc, body, bodyCapacity);
+    }
+
+    return headerLength + bodyLength;
+}
 
-        // Skip HTTP headers
-        char endOfHeaders[] = "\r\n\r\n";
-        if (!sslClient.find(endOfHeaders)) 
-        {
-            Serial.println(F("Invalid response"));
-
-            // Catch trailing result
-            while(sslClient.available()) {
-                Serial.write(sslClient.read());
-            }
-            
+bool NetworkHelper::readResponse(DynamicJsonDocument* responseDoc) {
+    size_t received = 0;
+    char* headerEnd = NULL;
+
+    // Read chunks until all headers are in the buffer
+    deadlineClient.setDeadline(budget->header);
+    while (headerEnd == NULL) {
+        if (! readUntil(&received, received + 1, HEADER_TIMEOUT)) {
             return false;
         }
+        if (received >= RESPONSE_BUFFER_SIZE - 1) {
+            drain();
+            return fail(RESPONSE_TOO_LARGE);
+        }
+        headerEnd = strstr(responseBuffer, "\r\n\r\n");
+    }
 
-        DeserializationError error = deserializeJson(*responseDoc, sslClient);
-        if (error) {
-            Serial.print(F("deserializeJson() failed: "));
-            Serial.println(error.c_str());
+    // Check HTTP status, it should be "HTTP/1.0 200 OK" or "HTTP/1.1 201 CREATED"
+    char* statusEnd = strstr(responseBuffer, "\r\n");
+    *statusEnd = '\0';
+    LOG_DEBUG("%s", responseBuffer);
+    int status = strncmp(responseBuffer, "HTTP/", 5) == 0 ? atoi(responseBuffer + 9) : 0;
+    lastStatus = status;
+    *statusEnd = '\r';
+
+    // Read the remaining body
+    char* body = headerEnd + 4;
+    size_t headerLength = body - responseBuffer;
+    long contentLength = parseContentLength(responseBuffer, headerEnd);
+
+    if (contentLength < 0) {
+        drain();
+        return fail(INVALID_RESPONSE);
+    }
+    if (headerLength + contentLength >= RESPONSE_BUFFER_SIZE) {
+        drain();
+        return fail(RESPONSE_TOO_LARGE);
+    }
 
-            // Catch trailing result
-            while(sslClient.available()) {
-                Serial.write(sslClient.read());
-            }
+    deadlineClient.setDeadline(budget->body);
+    if (! readUntil(&received, headerLength + contentLength, BODY_TIMEOUT)) {
+        return false;
+    }
+    size_t bodyLength = contentLength;
+    captureExchange(status, body, bodyLength, headerLength + bodyLength);
 
-            return false;
+    // The whole response has been read: nothing to drain, the connection stays usable for the next request
+    if (status != 200 && status != 201) {
+        LOG_WARN("Unexpected response: %d", status);
+        return fail(HTTP_STATUS);
+    }
+
+    DeserializationError error = msgPack
+        ? deserializeMsgPack(*responseDoc, (const char*)body, bodyLength)
+        : deserializeJson(*responseDoc, (const char*)body, bodyLength);
+    if (error) {
+        LOG_WARN("deserialize failed: %s", error.c_str());
+        return fail(INVALID_RESPONSE);
+    }
+
+    return true;
+}
+
+void NetworkHelper::captureExchange(int status, const char* body, size_t bodyLength, size_t responseLength) {
+    captured = true;
+    if (! capture) {
+        return;
+    }
+
+    uint8_t method = 3;
+    if (strcmp(captureMethod, "GET") == 0) method = 0;
+    else if (strcmp(captureMethod, "POST") == 0) method = 1;
+    else if (strcmp(captureMethod, "DELETE") == 0) method = 2;
+
+    size_t pathLength = strlen(capturePath);
+    size_t requestBodyLength = captureRequestLength - requestBodyOffset;
+
+    // record layout, see backend/tools/replay_trace.py
+    // Queued in the log buffer like any message, so capturing never waits for Serial
+    trace.begin(Log::beginLine());
+    trace.writeU8(TraceWriter::VERSION);
+    trace.writeU8(method);
+    trace.writeU8(msgPack ? 1 : 0);
+    trace.writeU8(lastError);
+    trace.writeU32(captureStart);
+    trace.writeU16(millis() - captureStart);
+    trace.writeU16(status);
+    trace.writeU16(captureRequestLength);
+    trace.writeU16(responseLength);
+    trace.writeU8(pathLength);
+    trace.write((const uint8_t*)capturePath, pathLength);
+    trace.writeU16(requestBodyLength);
+    trace.write((const uint8_t*)requestBuffer + requestBodyOffset, requestBodyLength);
+    trace.writeU16(bodyLength);
+    trace.write((const uint8_t*)body, bodyLength);
+    trace.end();
+    Log::endLine();
+}
+
+bool NetworkHelper::readUntil(size_t* received, size_t wanted, NetworkError timeoutError) {
+    // Read chunks until the buffer holds at least the wanted number of bytes
+    while (*received < wanted) {
+        if (deadlineClient.isExpired()) {
+            return fail(timeoutError);
         }
+        if (! sslClient.available() && ! sslClient.connected()) {
+            return fail(CONNECTION_CLOSED);
+        }
+
+        *received += readChunk(*received);
+        responseBuffer[*received] = '\0';
+    }
+
+    return true;
+}
+
+int NetworkHelper::readChunk(size_t offset) {
+    // Read whatever is available in one go, leave room for a terminating zero
+    int chunk = sslClient.read((uint8_t*)responseBuffer + offset, RESPONSE_BUFFER_SIZE - 1 - offset);
+    return chunk > 0 ? chunk : 0;
+}
+
+long NetworkHelper::parseContentLength(char* headers, char* headerEnd) {
+    const char name[] = "\r\ncontent-length:";
+    size_t nameLength = sizeof(name) - 1;
 
-        // Catch trailing result
-        while(sslClient.available()) {
-            Serial.write(sslClient.read());
+    for (char* line = headers; line < headerEnd; line++) {
+        if (strncasecmp(line, name, nameLength) == 0) {
+            return atol(line + nameLength);
         }
+    }
 
-        return true;
-    } else {
-        Serial.println("Backend is not connected. Connect before making a request!");
+    return -1;
+}
+
+void NetworkHelper::drain() {
+    // Catch trailing result in chunks, but never wait for it: read blocks until data arrives
+    deadlineClient.setDeadline(budget->drain);
+    int chunk;
+    while (! deadlineClient.isExpired() && sslClient.available() > 0
+           && (chunk = sslClient.read((uint8_t*)responseBuffer, RESPONSE_BUFFER_SIZE)) > 0) {
+        LOG_DEBUG("Drained %d bytes", chunk);
     }
+    deadlineClient.clearDeadline();
 }
 
 void NetworkHelper::disconnectBackend() {
     // Close connection
-    sslClient.println("Connection: close");
-    sslClient.println();
+    const char closeRequest[] = "Connection: close\r\n\r\n";
+    deadlineClient.setDeadline(budget->send);
+    sslClient.write((const uint8_t*)closeRequest, sizeof(closeRequest) - 1);
 
     // Catch remaining output
-    while(sslClient.available()) {
-        Serial.write(sslClient.read());
-    }
+    drain();
 
-    // Disconnect client
+    // Disconnect client, the close notify is bounded by the drain budget
+    deadlineClient.setDeadline(budget->drain);
     if (sslClient.connected()) {
         sslClient.stop();
     }
+    deadlineClient.clearDeadline();
+    releaseProbe();
 }
 
 void NetworkHelper::testBackend(const char *logmessage) {
   // connect
-  Serial.print("\nStarting connection to server ");
-  Serial.println(logmessage);
-  Serial.print("Free memory: ");
-  Serial.println(NetworkHelper::freeMemory());
+  LOG_INFO("Starting connection to server %s", logmessage);
+  LOG_DEBUG("Free memory: %d", NetworkHelper::freeMemory());
 
   ArduinoBearSSL.onGetTime(&NetworkHelper::getTimeCallback);
 
   // if you get a connection, report back via serial:
   if (sslClient.connect(backend, 443)) {
-    Serial.println("connected to server");
+    LOG_INFO("connected to server");
     // Make a HTTP request:
     sslClient.println("GET /habit/meditation HTTP/1.1");
     sslClient.print("Host: ");
@@ -248,19 +597,19 @@ void NetworkHelper::testBackend(const char *logmessage) {
     sslClient.println("Connection: close");
     sslClient.println();
   } else {
-    Serial.println("Failed to connect.");
+    LOG_WARN("Failed to connect.");
     sslClient.stop();
   }
   
-  Serial.print("available: ");
-  Serial.println(sslClient.available());
-  Serial.print("connected: ");
-  Serial.println(sslClient.connected());
+  LOG_DEBUG("available: %d", sslClient.available());
+  LOG_DEBUG("connected: %d", sslClient.connected());
 
   while(sslClient.connected()) {
     if(sslClient.available()) {
-      while(sslClient.available()) {
-        Serial.write(sslClient.read());
+      int chunk;
+      while((chunk = readChunk(0)) > 0) {
+        responseBuffer[chunk] = '\0';
+        LOG_INFO("%s", responseBuffer);
       }
       sslClient.stop();
       break;
@@ -6,38 +6,141 @@
 #include <BearSSLTrustAnchors.h>
 #include <ArduinoECCX08.h>
 #include <ArduinoJson.h>
+#include "DeadlineClient.h"
+#include "TraceWriter.h"
+#include <Log.h>
+
+/*
+* Time budget per network operation in milliseconds.
+* The sum is the worst case time a request blocks the loop.
+* WiFiNINA gives up a TCP connect after 10s on its own, the connect budget covers the TLS handshake on top.
+*/
+struct NetworkBudget {
+    unsigned long connect;  // TCP connect and TLS handshake
+    unsigned long send;     // writing the request
+    unsigned long header;   // until all response headers arrived
+    unsigned long body;     // until the response body arrived
+    unsigned long drain;    // reading trailing data before disconnect
+};
 
 class NetworkHelper {
     public:
         NetworkHelper(const char*, const char*);
 
+        enum NetworkError {
+            OK = 0,
+            NO_WIFI,
+            NOT_CONNECTED,
+            CONNECT_FAILED,
+            CONNECT_TIMEOUT,
+            REQUEST_TOO_LARGE,
+            SEND_TIMEOUT,
+            HEADER_TIMEOUT,
+            BODY_TIMEOUT,
+            RESPONSE_TOO_LARGE,
+            CONNECTION_CLOSED,
+            HTTP_STATUS,
+            INVALID_RESPONSE,
+            BACKEND_DOWN
+        };
+
+        // Backend health: closed lets requests through, open fails them at once until the backoff
+        // passed, half open lets one trial through that decides whether to close or open again
+        enum CircuitState {
+            CIRCUIT_CLOSED = 0,
+            CIRCUIT_OPEN,
+            CIRCUIT_HALF_OPEN
+        };
+
+        static const NetworkBudget INTERACTIVE_BUDGET;  // user is waiting for the result
+        static const NetworkBudget BACKGROUND_BUDGET;   // periodic syncs
+        static const char* errorName(NetworkError);
+
         static int freeMemory();
         static unsigned long getTimeCallback();
         static bool isWifiConnected();
         static bool isWifiTimeAvailable();
+        static unsigned long getWifiTime();
         static void connectWifi(const char*, const char*);
         static void printWifiStatus();
         static void checkWifiModule();
         static void checkWifiFirmware();
 
         BearSSLClient* getClient();
+        void setMsgPack(bool);
+        void setBudget(const NetworkBudget*);
+        void setCapture(bool);
+        NetworkError getLastError();
+        CircuitState getCircuitState();
         void testBackend(const char*);
         bool connectBackend();
         bool getRequest(const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc);
         bool postRequest(const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc);
         bool deleteRequest(const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc);
         void disconnectBackend();
+        bool isBackendConnected();
+
+        // Long poll: send a request now and receive its response once data arrives
+        bool sendRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc);
+        bool isResponseAvailable();
+        bool receiveResponse(DynamicJsonDocument* responseDoc);
+        void abortRequest();
 
     private:
         WiFiClient client;
+        DeadlineClient deadlineClient;
         BearSSLClient sslClient; 
         const char* backend;
         const char* certificate;
+        bool msgPack;  // use MessagePack instead of JSON for request and response bodies
+        const NetworkBudget* budget;
+        NetworkError lastError;
+        int lastStatus;  // HTTP status of the last response
+
+        static const int CIRCUIT_FAILURE_THRESHOLD;  // consecutive failures until the circuit opens
+        static const unsigned long BACKOFF_MIN;
+        static const unsigned long BACKOFF_MAX;
+        CircuitState circuit;
+        int failures;              // consecutive backend failures
+        unsigned long backoff;     // upper bound of the next retry delay, doubles with every failed trial
+        unsigned long openedAt;
+        unsigned long retryDelay;  // jittered delay until the next trial
+
+        static const size_t REQUEST_BUFFER_SIZE = 512;
+        static const size_t RESPONSE_BUFFER_SIZE = 1024;
+
+        // requests are assembled and responses read in these preallocated buffers
+        char requestBuffer[REQUEST_BUFFER_SIZE];
+        char responseBuffer[RESPONSE_BUFFER_SIZE];
+        size_t requestBodyOffset;  // where the body starts in the request buffer
+
+        // Capture mode: every exchange is queued in the log buffer as a trace record, see backend/tools/replay_trace.py
+        bool capture;
+        TraceWriter trace;
+        const char* captureMethod;
+        const char* capturePath;
+        size_t captureRequestLength;
+        unsigned long captureStart;
+        bool captured;  // the current exchange has been written
 
         static unsigned long lastWifiConnectTime;  // the last time we tried to connect to wifi
         static unsigned long wifiConnectDelay;  // wait this long before trying to reconnect to wifi
         
         bool httpRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc, DynamicJsonDocument* responseDoc);
+        size_t buildRequest(const char* method, const char* path, DynamicJsonDocument* requestDoc);
+        bool readResponse(DynamicJsonDocument* responseDoc);
+        void captureExchange(int status, const char* body, size_t bodyLength, size_t responseLength);
+        bool readUntil(size_t* received, size_t wanted, NetworkError timeoutError);
+        int readChunk(size_t offset);
+        bool fail(NetworkError);
+        bool isBackendFailure(NetworkError);
+        bool isBackendAnswer(NetworkError);
+        bool allowRequest();
+        void recordSuccess();
+        void recordFailure();
+        void releaseProbe();
+        long parseContentLength(char* headers, char* headerEnd);
+        void drain();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "TraceWriter.h"
+
+static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+TraceWriter::TraceWriter()
+    : sink(NULL),
+      pendingCount(0) {
+}
+
+void TraceWriter::begin(Print* _sink) {
+    sink = _sink;
+    pendingCount = 0;
+    sink->print("#JDT ");
+}
+
+void TraceWriter::writeU8(uint8_t value) {
+    write(&value, 1);
+}
+
+void TraceWriter::writeU16(uint16_t value) {
+    uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+    write(bytes, 2);
+}
+
+void TraceWriter::writeU32(uint32_t value) {
+    uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    write(bytes, 4);
+}
+
+void TraceWriter::write(const uint8_t* data, size_t length) {
+    for (size_t i=0; i<length; i++) {
+        pending[pendingCount++] = data[i];
+        if (pendingCount == 3) {
+            encodeGroup(3);
+            pendingCount = 0;
+        }
+    }
+}
+
+void TraceWriter::end() {
+    if (pendingCount > 0) {
+        encodeGroup(pendingCount);
+        pendingCount = 0;
+    }
+    sink->print("\r\n");
+}
+
+void TraceWriter::encodeGroup(int count) {
+    // 3 bytes -> 4 characters, padded with '=' at the end of the record
+    uint32_t bits = (uint32_t)pending[0] << 16;
+    if (count > 1) bits |= (uint32_t)pending[1] << 8;
+    if (count > 2) bits |= pending[2];
+
+    char out[4];
+    out[0] = BASE64[(bits >> 18) & 0x3f];
+    out[1] = BASE64[(bits >> 12) & 0x3f];
+    out[2] = count > 1 ? BASE64[(bits >> 6) & 0x3f] : '=';
+    out[3] = count > 2 ? BASE64[bits & 0x3f] : '=';
+    sink->write((const uint8_t*)out, 4);
+}
@@ -0,0 +1,32 @@
+#ifndef _TRACE_WRITER_H_
+#define _TRACE_WRITER_H_
+
+#include <Arduino.h>
+
+/*
+* Writes binary trace records as single base64 lines ("#JDT <base64>") to a Print,
+* so they can share the serial port with log output and be picked out of a capture by
+* backend/tools/replay_trace.py. Values are little endian.
+*/
+class TraceWriter {
+    public:
+        static const uint8_t VERSION = 1;
+
+        TraceWriter();
+
+        void begin(Print* sink);
+        void writeU8(uint8_t);
+        void writeU16(uint16_t);
+        void writeU32(uint32_t);
+        void write(const uint8_t* data, size_t length);
+        void end();
+
+    private:
+        Print* sink;
+        uint8_t pending[3];  // bytes waiting for a full base64 group
+        int pendingCount;
+
+        void encodeGroup(int count);
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "Calendar.h"
+
+Calendar::Calendar(Timezone* tz)
+    :tz{tz}
+    ,periodCount{0}
+    ,validFrom{0}
+    ,validUntil{0} {
+}
+
+void Calendar::invalidate() {
+    // the next query rebuilds the table from the new rules
+    validFrom = 0;
+    validUntil = 0;
+}
+
+long Calendar::localDay(time_t utc) {
+    return (utc + offsetAt(utc)) / SECS_PER_DAY;
+}
+
+long Calendar::secondOfDay(time_t utc) {
+    return (utc + offsetAt(utc)) % SECS_PER_DAY;
+}
+
+time_t Calendar::toUtc(long day, long secondOfDay) {
+    time_t local = (time_t)day * SECS_PER_DAY + secondOfDay;
+
+    // The offset at the local time read as UTC is at most one transition off,
+    // the offset at the instant it leads to is the right one.
+    // Across a DST transition this resolves a skipped local time to the instant after it
+    // and a repeated local time to its second occurrence.
+    time_t guess = local - offsetAt(local);
+    return local - offsetAt(guess);
+}
+
+time_t Calendar::nextTime(time_t utc, long secondOfDay) {
+    long day = localDay(utc);
+    time_t next = toUtc(day, secondOfDay);
+    if (next <= utc) {
+        next = toUtc(day + 1, secondOfDay);
+    }
+    return next;
+}
+
+long Calendar::monthStart(long day) {
+    // Day of month from the days since 1970-01-01 (civil_from_days by Howard Hinnant),
+    // counting in eras of 400 years that start on 0000-03-01, so leap days end a year
+    long shifted = day + 719468;
+    long era = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+    long dayOfEra = shifted - era * 146097;
+    long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long monthOfYear = (5 * dayOfYear + 2) / 153;
+    long dayOfMonth = dayOfYear - (153 * monthOfYear + 2) / 5 + 1;
+    return day - dayOfMonth + 1;
+}
+
+long Calendar::offsetAt(time_t utc) {
+    if (utc < validFrom || utc >= validUntil) {
+        build(utc);
+    }
+
+    int p = periodCount - 1;
+    while (p > 0 && periods[p].start > utc) {
+        p--;
+    }
+    return periods[p].offset;
+}
+
+long Calendar::tzOffset(time_t utc) {
+    return (long)(tz->tzTime(utc, UTC_TIME) - utc);
+}
+
+void Calendar::build(time_t utc) {
+    tmElements_t tm;
+    breakTime(utc, tm);
+    tm.Month = 1;
+    tm.Day = 1;
+    tm.Hour = 0;
+    tm.Minute = 0;
+    tm.Second = 0;
+    time_t yearStart = makeTime(tm);
+
+    periods[0].start = yearStart;
+    periods[0].offset = tzOffset(yearStart);
+    periodCount = 1;
+
+    // Sample the offset at the start of every month, a month with a transition is searched for the exact second.
+    // Rules change at most once a month, so this finds every transition of the year.
+    time_t monthStart = yearStart;
+    for (int month = 2; month <= 13; month++) {
+        if (month == 13) {
+            tm.Month = 1;
+            tm.Year = tm.Year + 1;
+        } else {
+            tm.Month = month;
+        }
+        time_t nextMonthStart = makeTime(tm);
+        if (tzOffset(nextMonthStart) != periods[periodCount - 1].offset) {
+            addTransition(monthStart, nextMonthStart);
+        }
+        monthStart = nextMonthStart;
+    }
+    // Local times around new year are looked up with the offset of the neighbouring year,
+    // a day of overlap keeps them from rebuilding the table back and forth.
+    validFrom = yearStart - SECS_PER_DAY;
+    validUntil = monthStart + SECS_PER_DAY;
+
+    LOG_INFO("Calendar for %d: %d periods, offset %ld s", 1970 + tm.Year - 1, periodCount, periods[0].offset);
+}
+
+void Calendar::addTransition(time_t before, time_t after) {
+    // before still has the offset of the last period, after already has the new one
+    long offset = tzOffset(after);
+    while (after - before > 1) {
+        time_t middle = before + (after - before) / 2;
+        if (tzOffset(middle) == offset) {
+            after = middle;
+        } else {
+            before = middle;
+        }
+    }
+
+    if (periodCount == MAX_PERIODS) {
+        LOG_WARN("Calendar: too many transitions, ignoring the one at %lu", (unsigned long)after);
+        return;
+    }
+    periods[periodCount].start = after;
+    periods[periodCount].offset = offset;
+    periodCount++;
+}
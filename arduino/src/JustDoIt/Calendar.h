@@ -0,0 +1,47 @@
+#ifndef _CALENDAR_H_
+#define _CALENDAR_H_
+
+#include <Arduino.h>
+#include <ezTime.h>
+#include <Log.h>
+
+/*
+* Local calendar arithmetic without ezTime in the hot path.
+* For the UTC year around the current time the calendar keeps a small table of periods with a constant
+* UTC offset, split at the DST transitions. It is built from the timezone rules once per year
+* (or after invalidate() on a timezone change), every query is integer math and a table lookup.
+*/
+class Calendar {
+    public:
+        Calendar(Timezone* tz);
+
+        void invalidate();
+
+        long localDay(time_t utc);  // local epoch day: days since 1970-01-01 in local time
+        long secondOfDay(time_t utc);  // local seconds since midnight
+        time_t toUtc(long day, long secondOfDay);  // the instant of a local day and time of day
+        time_t nextTime(time_t utc, long secondOfDay);  // the first instant after utc at this local time of day
+
+        static long monthStart(long day);  // the first epoch day of the month of day
+
+    private:
+        static const int MAX_PERIODS = 4;  // a year with two DST transitions has three periods
+
+        struct Period {
+            time_t start;  // UTC
+            long offset;   // seconds local time is ahead of UTC
+        };
+
+        Timezone* tz;
+        Period periods[MAX_PERIODS];
+        int periodCount;
+        time_t validFrom;
+        time_t validUntil;
+
+        void build(time_t utc);
+        void addTransition(time_t before, time_t after);
+        long tzOffset(time_t utc);
+        long offsetAt(time_t utc);
+};
+
+#endif
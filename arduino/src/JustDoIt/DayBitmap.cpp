@@ -0,0 +1,110 @@
+#include "DayBitmap.h"
+
+
+DayBitmap::DayBitmap()
+ :words{NULL},
+  dayCount{0},
+  wordCount{0} {
+}
+
+void DayBitmap::init(int _dayCount) {
+    dayCount = _dayCount;
+    wordCount = (dayCount + 31) / 32;
+    words = (uint32_t*) calloc(wordCount, sizeof(uint32_t));
+}
+
+int DayBitmap::getDayCount() {
+    return dayCount;
+}
+
+int DayBitmap::getWordCount() {
+    return wordCount;
+}
+
+uint32_t DayBitmap::getWord(int w) {
+    return words[w];
+}
+
+void DayBitmap::setWord(int w, uint32_t word) {
+    words[w] = word;
+    if (w == wordCount - 1) {
+        maskLastWord();
+    }
+}
+
+bool DayBitmap::get(int day) {
+    if (day < 0 || day >= dayCount) {
+        return false;
+    }
+    return (words[day / 32] >> (day % 32)) & 1;
+}
+
+void DayBitmap::set(int day, bool value) {
+    if (day < 0 || day >= dayCount) {
+        return;
+    }
+
+    uint32_t mask = (uint32_t)1 << (day % 32);
+    if (value) {
+        words[day / 32] |= mask;
+    } else {
+        words[day / 32] &= ~mask;
+    }
+}
+
+void DayBitmap::clear() {
+    for (int w=0; w<wordCount; w++) {
+        words[w] = 0;
+    }
+}
+
+void DayBitmap::shift() {
+    // every day moves one day back, the oldest day falls off, today starts cleared
+    for (int w=wordCount-1; w>0; w--) {
+        words[w] = (words[w] << 1) | (words[w-1] >> 31);
+    }
+    words[0] <<= 1;
+    maskLastWord();
+}
+
+int DayBitmap::count() {
+    int ones = 0;
+    for (int w=0; w<wordCount; w++) {
+        ones += __builtin_popcount(words[w]);
+    }
+    return ones;
+}
+
+int DayBitmap::runLength(int from) {
+    // number of consecutive set bits starting at day 'from', counting back in time
+    int length = 0;
+    int day = from;
+
+    while (day < dayCount) {
+        int bit = day % 32;
+        int bitsLeft = 32 - bit;
+
+        // count trailing ones; bits shifted in from the top are zeros and stop the run
+        uint32_t zeros = ~(words[day / 32] >> bit);
+        int run = zeros == 0 ? 32 : __builtin_ctz(zeros);
+        if (run > bitsLeft) {
+            run = bitsLeft;
+        }
+
+        length += run;
+        day += run;
+        if (run < bitsLeft) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+void DayBitmap::maskLastWord() {
+    // keep bits beyond the last day cleared, so runs and counts stop there
+    int usedBits = dayCount - (wordCount - 1) * 32;
+    if (usedBits < 32) {
+        words[wordCount - 1] &= ((uint32_t)1 << usedBits) - 1;
+    }
+}
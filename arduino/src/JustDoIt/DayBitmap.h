@@ -0,0 +1,35 @@
+#ifndef _DAY_BITMAP_H_
+#define _DAY_BITMAP_H_
+
+#include <Arduino.h>
+
+/*
+* One bit per day packed into 32 bit words: bit 0 of word 0 is today, each following bit counts one day back.
+*/
+class DayBitmap {
+    public:
+        DayBitmap();
+
+        void init(int dayCount);
+
+        int getDayCount();
+        int getWordCount();
+        uint32_t getWord(int);
+        void setWord(int, uint32_t);
+
+        bool get(int);
+        void set(int, bool);
+        void clear();
+        void shift();
+        int count();
+        int runLength(int);
+
+    private:
+        uint32_t* words;
+        int dayCount;
+        int wordCount;
+
+        void maskLastWord();
+};
+
+#endif
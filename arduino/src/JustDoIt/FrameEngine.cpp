@@ -0,0 +1,298 @@
+#include "FrameEngine.h"
+
+#include <wiring_private.h>
+
+// DMA descriptors have to be 128 bit aligned
+static DmacDescriptor dmaDescriptor __attribute__ ((aligned (16)));
+static DmacDescriptor dmaWriteback __attribute__ ((aligned (16)));
+
+FrameEngine* FrameEngine::active = NULL;
+
+const int FrameEngine::FRAME_RATE = 50;
+const int FrameEngine::DMA_CHANNEL = 0;
+const int FrameEngine::BYTES_PER_PIXEL = 3 * 3;  // 3 colors, every color bit takes 3 SPI bits
+const int FrameEngine::LATCH_BYTES = 90;  // > 280us low at 2.4MHz
+const uint8_t FrameEngine::FADE_STEP = 16;  // full fade takes 16 frames
+const int FrameEngine::SPINNER_FRAMES_PER_PIXEL = 2;
+const int FrameEngine::SPINNER_TAIL = 3;
+
+// SPI bits of a color nibble: 4 NeoPixel bits -> 12 SPI bits
+const uint16_t FrameEngine::NIBBLE_BITS[16] = {
+    04444, 04446, 04464, 04466, 04644, 04646, 04664, 04666,
+    06444, 06446, 06464, 06466, 06644, 06646, 06664, 06666
+};
+
+FrameEngine::FrameEngine(int _pixelCount, int _pixelPin, int _brightness)
+    : pixelCount(_pixelCount),
+      pixelPin(_pixelPin),
+      brightness(_brightness),
+      loading{false},
+      frame{0},
+      spinnerShown{false},
+      spinnerHead{0} {
+
+        target = (uint8_t*) calloc(pixelCount * 3, sizeof(uint8_t));
+        current = (uint8_t*) calloc(pixelCount * 3, sizeof(uint8_t));
+
+        encodedLength = pixelCount * BYTES_PER_PIXEL + LATCH_BYTES;
+        encoded = (uint8_t*) calloc(encodedLength, sizeof(uint8_t));
+
+        // all pixels start stale, so the first frame turns them all off
+        maskWords = (pixelCount + 31) / 32;
+        fading = (uint32_t*) calloc(maskWords, sizeof(uint32_t));
+        stale = (uint32_t*) malloc(maskWords * sizeof(uint32_t));
+        memset(stale, 0xff, maskWords * sizeof(uint32_t));
+}
+
+void FrameEngine::begin() {
+    active = this;
+
+    initSpi();
+    initDma();
+    initTimer();
+}
+
+void FrameEngine::setPixelColor(int pixel, uint32_t color) {
+    if (pixel < 0 || pixel >= pixelCount) {
+        return;
+    }
+
+    // store as GRB, which is the order the pixels expect on the wire
+    uint8_t g = (uint8_t)(color >> 8);
+    uint8_t r = (uint8_t)(color >> 16);
+    uint8_t b = (uint8_t)color;
+
+    uint8_t* p = &target[pixel * 3];
+    if (p[0] == g && p[1] == r && p[2] == b) {
+        return;
+    }
+
+    // the timer interrupt clears bits of the same word
+    noInterrupts();
+    p[0] = g;
+    p[1] = r;
+    p[2] = b;
+    setBit(fading, pixel);
+    interrupts();
+}
+
+void FrameEngine::setLoading(bool l) {
+    loading = l;
+}
+
+void FrameEngine::onTimer() {
+    if (active != NULL) {
+        active->tick();
+    }
+}
+
+void FrameEngine::tick() {
+    frame++;
+    fade();
+
+    // the previous frame is still being sent; try again next tick
+    if (isDmaBusy()) {
+        return;
+    }
+
+    updateSpinner();
+    if (encode()) {
+        startDma();
+    }
+}
+
+void FrameEngine::initSpi() {
+    // PIXEL_PIN 6 is PA04, which is PAD[0] of SERCOM0 on the alternative peripheral function
+    pinPeripheral(pixelPin, PIO_SERCOM_ALT);
+
+    sercom0.initSPI(SPI_PAD_0_SCK_1, SERCOM_RX_PAD_3, SPI_CHAR_SIZE_8_BITS, MSB_FIRST);
+    sercom0.initSPIClock(SERCOM_SPI_MODE_0, 2400000);
+    sercom0.enableSPI();
+}
+
+void FrameEngine::initDma() {
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+    DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;
+    DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+    while (DMAC->CTRL.reg & DMAC_CTRL_SWRST);
+
+    DMAC->BASEADDR.reg = (uint32_t)&dmaDescriptor;
+    DMAC->WRBADDR.reg = (uint32_t)&dmaWriteback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+    DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST);
+
+    // one byte per SERCOM0 TX ready trigger
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0)
+        | DMAC_CHCTRLB_TRIGSRC(SERCOM0_DMAC_ID_TX)
+        | DMAC_CHCTRLB_TRIGACT_BEAT;
+
+    // the source address points to the end of the block when incrementing
+    dmaDescriptor.BTCTRL.reg = DMAC_BTCTRL_VALID
+        | DMAC_BTCTRL_BEATSIZE_BYTE
+        | DMAC_BTCTRL_SRCINC
+        | DMAC_BTCTRL_BLOCKACT_NOACT;
+    dmaDescriptor.BTCNT.reg = encodedLength;
+    dmaDescriptor.SRCADDR.reg = (uint32_t)encoded + encodedLength;
+    dmaDescriptor.DSTADDR.reg = (uint32_t)&SERCOM0->SPI.DATA.reg;
+    dmaDescriptor.DESCADDR.reg = 0;
+}
+
+void FrameEngine::initTimer() {
+    // TC4 at FRAME_RATE Hz from the 48MHz main clock
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(GCM_TC4_TC5);
+    while (GCLK->STATUS.bit.SYNCBUSY);
+
+    TC4->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+    while (TC4->COUNT16.STATUS.bit.SYNCBUSY);
+
+    TC4->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER_DIV1024;
+    TC4->COUNT16.CC[0].reg = F_CPU / 1024 / FRAME_RATE - 1;
+    while (TC4->COUNT16.STATUS.bit.SYNCBUSY);
+
+    TC4->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+
+    // lowest priority: frames may be late, but must never delay the USB or WiFi handling
+    NVIC_SetPriority(TC4_IRQn, 3);
+    NVIC_EnableIRQ(TC4_IRQn);
+
+    TC4->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+    while (TC4->COUNT16.STATUS.bit.SYNCBUSY);
+}
+
+bool FrameEngine::isDmaBusy() {
+    DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+    return DMAC->CHCTRLA.reg & DMAC_CHCTRLA_ENABLE;
+}
+
+void FrameEngine::startDma() {
+    // the channel disables itself once the block has been transferred
+    DMAC->CHID.reg = DMAC_CHID_ID(DMA_CHANNEL);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+}
+
+void FrameEngine::fade() {
+    for (int w=0; w<maskWords; w++) {
+        uint32_t bits = fading[w];
+
+        // most words are settled: skip 32 pixels at once
+        while (bits) {
+            int pixel = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            bool settled = true;
+            for (int i=pixel * 3; i<pixel * 3 + 3; i++) {
+                uint8_t t = target[i];
+                uint8_t c = current[i];
+
+                if (c < t) {
+                    current[i] = (t - c > FADE_STEP) ? c + FADE_STEP : t;
+                } else if (c > t) {
+                    current[i] = (c - t > FADE_STEP) ? c - FADE_STEP : t;
+                }
+                settled = settled && current[i] == t;
+            }
+
+            setBit(stale, pixel);
+            if (settled) {
+                fading[w] &= ~(1UL << (pixel % 32));
+            }
+        }
+    }
+}
+
+void FrameEngine::updateSpinner() {
+    // the spinner runs backwards around the strip, starting at pixel 0
+    int position = (frame / SPINNER_FRAMES_PER_PIXEL) % pixelCount;
+    int head = (pixelCount - position) % pixelCount;
+
+    if (spinnerShown == loading && (! loading || head == spinnerHead)) {
+        return;
+    }
+
+    // re-encode where the spinner was and where it is now
+    if (spinnerShown) {
+        markSpinner(spinnerHead);
+    }
+    if (loading) {
+        markSpinner(head);
+    }
+    spinnerShown = loading;
+    spinnerHead = head;
+}
+
+void FrameEngine::markSpinner(int head) {
+    for (int i=0; i<SPINNER_TAIL; i++) {
+        setBit(stale, (head + i) % pixelCount);
+    }
+}
+
+bool FrameEngine::encode() {
+    bool changed = false;
+
+    for (int w=0; w<maskWords; w++) {
+        uint32_t bits = stale[w];
+        stale[w] = 0;
+        changed = changed || bits;
+
+        while (bits) {
+            encodePixel(w * 32 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    // the latch bytes at the end stay zero
+
+    return changed;
+}
+
+void FrameEngine::encodePixel(int pixel) {
+    uint8_t* out = &encoded[pixel * BYTES_PER_PIXEL];
+    uint8_t spinner[3];
+
+    uint8_t* color = &current[pixel * 3];
+    if (spinnerShown && spinnerColor(pixel, spinner)) {
+        color = spinner;
+    }
+
+    for (int i=0; i<3; i++) {
+        out = encodeByte(out, (color[i] * (brightness + 1)) >> 8);
+    }
+}
+
+uint8_t* FrameEngine::encodeByte(uint8_t* out, uint8_t value) {
+    // 8 color bits -> 24 SPI bits
+    uint32_t bits = ((uint32_t)NIBBLE_BITS[value >> 4] << 12) | NIBBLE_BITS[value & 0x0f];
+
+    out[0] = bits >> 16;
+    out[1] = bits >> 8;
+    out[2] = bits;
+    return out + 3;
+}
+
+bool FrameEngine::spinnerColor(int pixel, uint8_t* color) {
+    // the spinner has a fading tail behind its head
+    int distance = (pixel - spinnerHead + pixelCount) % pixelCount;
+
+    if (distance >= SPINNER_TAIL) {
+        return false;
+    }
+
+    color[0] = 0;
+    color[1] = 127 >> distance;  // red
+    color[2] = 0;
+    return true;
+}
+
+void FrameEngine::setBit(uint32_t* mask, int pixel) {
+    mask[pixel / 32] |= 1UL << (pixel % 32);
+}
+
+void TC4_Handler() {
+    TC4->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+    FrameEngine::onTimer();
+}
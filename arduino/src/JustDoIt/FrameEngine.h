@@ -0,0 +1,73 @@
+#ifndef _FRAME_ENGINE_H_
+#define _FRAME_ENGINE_H_
+
+#include <Arduino.h>
+
+/*
+* Drives the NeoPixels in the background:
+* A timer interrupt renders frames at a fixed rate (fading towards the target colors and
+* drawing the loading spinner) and pushes them out via DMA through SERCOM0 in SPI mode.
+* Every NeoPixel bit is encoded as three SPI bits at 2.4MHz (0 -> 100, 1 -> 110),
+* so no interrupts have to be disabled while the pixels are written.
+* Updates are incremental: only fading pixels are faded, only changed pixels are encoded,
+* and a frame is sent only if something changed (the pixels hold their color).
+*/
+class FrameEngine {
+    public:
+        FrameEngine(int, int, int);
+
+        static const int FRAME_RATE;
+
+        void begin();
+        void setPixelColor(int, uint32_t);
+        void setLoading(bool);
+
+        static void onTimer();
+
+    private:
+        static FrameEngine* active;
+
+        static const int DMA_CHANNEL;
+        static const int BYTES_PER_PIXEL;
+        static const int LATCH_BYTES;
+        static const uint8_t FADE_STEP;
+        static const int SPINNER_FRAMES_PER_PIXEL;
+        static const int SPINNER_TAIL;
+        static const uint16_t NIBBLE_BITS[16];
+
+        int pixelCount;
+        int pixelPin;
+        int brightness;
+
+        uint8_t* target;   // colors requested by the strip (GRB)
+        uint8_t* current;  // colors currently shown, fading towards target (GRB)
+        uint8_t* encoded;  // SPI encoded frame incl. latch bytes
+        int encodedLength;
+
+        // one bit per pixel
+        int maskWords;
+        uint32_t* fading;  // current differs from target
+        uint32_t* stale;   // encoded frame differs from what should be shown
+
+        volatile bool loading;
+        volatile uint32_t frame;
+        bool spinnerShown;
+        int spinnerHead;   // first pixel of the spinner in the last encoded frame
+
+        void initSpi();
+        void initDma();
+        void initTimer();
+        void tick();
+        bool isDmaBusy();
+        void startDma();
+        void fade();
+        void updateSpinner();
+        void markSpinner(int);
+        bool encode();
+        void encodePixel(int);
+        uint8_t* encodeByte(uint8_t*, uint8_t);
+        bool spinnerColor(int, uint8_t*);
+        static void setBit(uint32_t*, int);
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "Habit.h"
+
+
+const size_t Habit::PATH_LENGTH = sizeof(char) * ( 40 + 1 );
+
+Habit::Habit()
+ :name{NULL},
+  path{NULL},
+  firstPixel{0},
+  dayCount{0},
+  today{0},
+  carry{0},
+  statsFrom{-1},
+  statsDone{0} {
+}
+
+void Habit::init(const char* _name, int _firstPixel, int _dayCount) {
+    name = _name;
+    firstPixel = _firstPixel;
+    dayCount = _dayCount;
+
+    path = (char*) malloc( PATH_LENGTH );
+    snprintf(path, PATH_LENGTH, "/habit/%s", name);
+
+    done.init(dayCount);
+    pending.init(dayCount);
+}
+
+const char* Habit::getName() {
+    return name;
+}
+
+const char* Habit::getPath() {
+    return path;
+}
+
+int Habit::getFirstPixel() {
+    return firstPixel;
+}
+
+int Habit::getDayCount() {
+    return dayCount;
+}
+
+long Habit::getToday() {
+    return today;
+}
+
+bool Habit::isDone(int index) {
+    return done.get(index);
+}
+
+bool Habit::isPending(int index) {
+    return pending.get(index);
+}
+
+bool Habit::hasPending() {
+    return pending.count() > 0;
+}
+
+int Habit::getStreak(int index) {
+    // consecutive days done, counting back from index
+    int streak = done.runLength(index);
+
+    // the streak reaches beyond the window: continue with what the backend knows
+    if (index + streak == dayCount) {
+        streak += carry;
+    }
+
+    return streak;
+}
+
+int Habit::getMonthDone(long monthStart) {
+    // days of the month inside the window, including changes not synced yet
+    int count = 0;
+    for (int i=0; i<dayCount && today - i >= monthStart; i++) {
+        if (done.get(i)) {
+            count++;
+        }
+    }
+
+    // the rest of the month, as far as the backend counted it for this month
+    if (monthStart == statsFrom) {
+        count += statsDone;
+    }
+    return count;
+}
+
+void Habit::newDay(long day) {
+    // The day falling off the window continues or ends the carried streak
+    carry = done.get(dayCount - 1) ? carry + 1 : 0;
+    if (done.get(dayCount - 1) && today - (dayCount - 1) >= statsFrom) {
+        statsDone++;
+    }
+
+    // Shift all days to the 'right' (last day will be dropped)
+    done.shift();
+    pending.shift();
+
+    today = day;
+}
+
+void Habit::toggle(int index) {
+    done.set(index, ! done.get(index));
+    pending.set(index, ! pending.get(index));
+}
+
+bool Habit::syncUp(NetworkHelper* networkHelper, long* version) {
+    // one request for all days done, one for all days undone; only if there are any
+    bool synced = syncDays(true, networkHelper, version);
+    return syncDays(false, networkHelper, version) && synced;
+}
+
+bool Habit::syncDays(bool doneState, NetworkHelper* networkHelper, long* version) {
+    int count = 0;
+    for (int i=0; i<dayCount; i++) {
+        if (pending.get(i) && done.get(i) == doneState) {
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return true;
+    }
+
+    DynamicJsonDocument requestDoc(JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(count));
+    DynamicJsonDocument responseDoc(JSON_OBJECT_SIZE(2) + sizeof("deleted") + sizeof("version"));
+
+    JsonArray days = requestDoc.createNestedArray("days");
+    for (int i=0; i<dayCount; i++) {
+        if (pending.get(i) && done.get(i) == doneState) {
+            days.add(today - i);
+        }
+    }
+
+    bool success;
+    if (doneState) {
+        success = networkHelper->postRequest(path, &requestDoc, &responseDoc) && responseDoc["added"] >= 0;
+    } else {
+        success = networkHelper->deleteRequest(path, &requestDoc, &responseDoc) && responseDoc["deleted"] >= 0;
+    }
+
+    if (success) {
+        LOG_INFO("Synced %d days of %s to backend", count, name);
+
+        // Our own change is the next version: no need to sync it back when the watch reports it.
+        // A bigger step means other clients changed something too, the watch will catch that.
+        long changeVersion = responseDoc["version"] | -1L;
+        if (changeVersion == *version + 1) {
+            *version = changeVersion;
+        }
+
+        for (int i=0; i<dayCount; i++) {
+            if (pending.get(i) && done.get(i) == doneState) {
+                pending.set(i, false);
+            }
+        }
+    }
+
+    return success;
+}
+
+void Habit::applyWindow(JsonObject window, long _statsFrom) {
+    // done state is a bitmap of 32 bit words, bit 0 of the first word being today
+    JsonArray bits = window["bits"];
+
+    for (int w=0; w<done.getWordCount() && w<(int)bits.size(); w++) {
+        // don't overwrite local changes that have not reached the backend yet
+        uint32_t remote = bits[w];
+        uint32_t local = pending.getWord(w);
+        done.setWord(w, (remote & ~local) | (done.getWord(w) & local));
+    }
+
+    carry = window["carry"];
+
+    // the backend counts the days before the window, the window itself is counted locally
+    statsFrom = _statsFrom;
+    statsDone = window["stats"][0]["done"] | 0;
+}
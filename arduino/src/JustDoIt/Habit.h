@@ -0,0 +1,50 @@
+#ifndef _HABIT_H_
+#define _HABIT_H_
+
+#include "DayBitmap.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <NetworkHelper.h>
+
+class Habit {
+public:
+  Habit();
+
+  void init(const char* name, int firstPixel, int dayCount);
+
+  const char* getName();
+  const char* getPath();
+  int getFirstPixel();
+  int getDayCount();
+  long getToday();
+
+  bool isDone(int index);
+  bool isPending(int index);
+  bool hasPending();
+  int getStreak(int index);
+  int getMonthDone(long monthStart);
+
+  void newDay(long day);
+  void toggle(int index);
+  bool syncUp(NetworkHelper*, long* version);
+  void applyWindow(JsonObject window, long statsFrom);
+
+private:
+  static const size_t PATH_LENGTH;
+
+  const char* name;
+  char* path;
+  int firstPixel;
+  int dayCount;
+  long today;  // local epoch day of index 0
+
+  DayBitmap done;     // local state, including changes not synced yet
+  DayBitmap pending;  // days changed locally that the backend doesn't know about
+  int carry;          // streak carried in from before the oldest day in the window
+  long statsFrom;     // first day of the range the backend counted up to the window
+  int statsDone;      // days done from statsFrom up to the oldest day in the window
+
+  bool syncDays(bool doneState, NetworkHelper*, long* version);
+};
+
+#endif
@@ -1,7 +1,6 @@
 #include "JustDoIt.h"
 #include "arduino_secrets.h" 
 #include "Strip.h"
-#include "It.h"
 #include "Timing.h"
 
 #include <Wire.h>
@@ -11,67 +10,111 @@
 #include <ArduinoBearSSL.h>
 #include <ArduinoECCX08.h>
 #include <NetworkHelper.h>
+#include <Log.h>
 
-const byte BUTTON_PIN  = 2;
 const byte PIR_PIN     = 3;
-const int PIXEL_PIN   = 6;
+const int PIXEL_PIN   = 6;   // SERCOM0 PAD[0], driven via DMA by the FrameEngine
 const byte LED_PIN     = 13;  // Arduino built-in LED
-const int  PIXEL_COUNT = 60;  // Number of NeoPixels
 const int  BRIGHTNESS  = 255;
 const bool WAIT_FOR_SERIAL = false;
 const int QUIET_HOUR_START = 21;
 const int QUIET_HOUR_END = 8;
 const int QUIET_HOUR_PAUSE = 1;
-const int SYNC_INTERVAL = 15;
+const int SYNC_INTERVAL = 60;  // changes from other clients arrive via the watch request
+const unsigned long FLUSH_DELAY = 3000;  // button presses within this window go out in one connection
+const unsigned long SYNC_RETRY_DELAY = 30000;  // a failed sync after (re)connecting is retried this often
+const bool CAPTURE_TRAFFIC = false;  // queue a trace of every backend exchange with the log output, see backend/tools/replay_trace.py
+const bool USE_MSGPACK = true;  // binary request and response bodies
+
+// Each habit gets its own segment of the strip and its own button
+const char* const HABITS[] = {"meditation"};
+const byte BUTTON_PINS[]   = {2};
+const int  HABIT_COUNT     = sizeof(HABITS) / sizeof(HABITS[0]);
 
 // Supply backend address and certificate via secrets file
 NetworkHelper networkHelper(BACKEND_ADDRESS, CERTIFICATE);
 
-// Pixel variables
-Strip strip(PIXEL_COUNT, PIXEL_PIN, BRIGHTNESS);
+// Pixel variables: the layout of each habit's segment,
+// e.g. RingLayout(60), LinearLayout(144) or MatrixLayout(53, 7) for a year calendar
+RingLayout layout(60 / HABIT_COUNT);
+Strip strip(&layout, PIXEL_PIN, BRIGHTNESS, HABITS, HABIT_COUNT);
 
 // Control flow variables
-int currentButtonState;       // the actual current button state after debouncing
-int lastButtonState = HIGH;   // the previous reading from the input pin
-unsigned long lastDebounceTime = 0;  // the last time the output pin was toggled
+int currentButtonState[HABIT_COUNT];        // the actual current button state after debouncing
+int lastButtonState[HABIT_COUNT];           // the previous reading from the input pin
+unsigned long lastDebounceTime[HABIT_COUNT];  // the last time the output pin was toggled
 unsigned long debounceDelay = 50;    // the debounce time; increase if the output flickers
+unsigned long pressStart[HABIT_COUNT];  // when the button went down
+bool pressToggled[HABIT_COUNT];         // the press marked today, undone if it turns into a long press
+bool longPressHandled[HABIT_COUNT];     // the button is still held after a long press
+unsigned long longPressDelay = 2000;    // holding the button this long switches between days and month completion
 
 unsigned long lastPirTime = 0;  // the last time the PIR sensor was triggered by movement
 unsigned long pirDelay = 30000;  // Turn on LEDs for this long after PIR Sensor was triggered
 
+Scheduler::Handle syncTimer = Scheduler::INVALID_HANDLE;  // periodic backend sync
+Scheduler::Handle dayTimer = Scheduler::INVALID_HANDLE;   // day rollover
+Scheduler::Handle flushTimer = Scheduler::INVALID_HANDLE; // write-behind of button presses
+
+bool started = false;       // time is known: strip shows the current day and timers are running
+bool online = false;        // synced with the backend since wifi (re)connected
+bool syncFailed = false;    // the last attempt to get online failed, retry after SYNC_RETRY_DELAY
+unsigned long lastSyncAttempt = 0;
+bool bootReported = false;  // time until the first fully rendered strip was logged
+
 /*
 * Function prototypes
 */
 void setup(void);
 void loop(void);
-void everyDay();
-void fullSync();
+void readButton(int);
+void everyDay(void*);
+void fullSync(void*);
+void flushPresses(void*);
 void quietHour(bool);
 void initLog();
 void requireLoop();
 
 void setup() {
   initLog();
+  randomSeed(analogRead(A0));  // unconnected pin: noise for the network retry jitter
   pinMode(LED_PIN, OUTPUT);  // init artuino LED
-  pinMode(BUTTON_PIN, INPUT_PULLUP);  // init button
+  for (int h=0; h<HABIT_COUNT; h++) {
+    pinMode(BUTTON_PINS[h], INPUT_PULLUP);  // init buttons
+    lastButtonState[h] = HIGH;
+    longPressHandled[h] = true;  // no press yet
+  }
   pinMode(PIR_PIN, INPUT);  // init PIR motion sensor
+  strip.begin();  // start background frame rendering
+  Timing::begin();  // time from the RTC, if it survived the reset
   
   NetworkHelper::checkWifiModule();
   NetworkHelper::checkWifiFirmware();
+  networkHelper.setMsgPack(USE_MSGPACK);
+  if (CAPTURE_TRAFFIC) {
+    networkHelper.setCapture(true);
+  }
 
-  Serial.print("Free memory: ");
-  Serial.println(NetworkHelper::freeMemory());
+  LOG_DEBUG("Free memory: %d", NetworkHelper::freeMemory());
 }
 
 void loop() {
   strip.visualize();
 
+  // send one chunk of queued log messages to Serial, skipped while no host has the port open
+  Log::flush();
+
   // while no time is available, this method will try to reconnect to NTP
   requireLoop();
 
-  // ezTime event trigger
+  // ezTime and scheduler event trigger
   Timing::callEvents();
 
+  // pick up changes from other clients as soon as the backend reports them
+  if (online) {
+    strip.watch(&networkHelper);
+  }
+
   int readPir = digitalRead(PIR_PIN);
   if (readPir == HIGH) {
     lastPirTime = millis();
@@ -82,110 +125,162 @@ void loop() {
     strip.setAwake(false);
   }
 
-  int readButton = digitalRead(BUTTON_PIN);
-  if (readButton != lastButtonState) {
+  for (int h=0; h<HABIT_COUNT; h++) {
+    readButton(h);
+  }
+}
+
+void readButton(int habit) {
+  int reading = digitalRead(BUTTON_PINS[habit]);
+  if (reading != lastButtonState[habit]) {
     // reset the debouncing timer
-    lastDebounceTime = millis();
+    lastDebounceTime[habit] = millis();
   }
 
   // signal is present > debounce time
-  if ((millis() - lastDebounceTime) > debounceDelay) {
+  if ((millis() - lastDebounceTime[habit]) > debounceDelay) {
 
     // update current button state
-    if (readButton != currentButtonState) {
-      currentButtonState = readButton;
+    if (reading != currentButtonState[habit]) {
+      currentButtonState[habit] = reading;
+
+      // Before the time is known there is no day to mark, the press is dropped
+      if (currentButtonState[habit] == LOW && ! started) {
+        LOG_INFO("Button pressed for habit %s, ignored until the time is known", HABITS[habit]);
+      }
 
       // Button has been pressed
-      if (currentButtonState == LOW) {
-        Serial.println("Button pressed.");
+      else if (currentButtonState[habit] == LOW) {
+        LOG_INFO("Button pressed for habit %s", HABITS[habit]);
+        pressStart[habit] = millis();
+        pressToggled[habit] = false;
+        longPressHandled[habit] = false;
+
         // get quiet hours...
         if(strip.getQuietHours()) {
           Timing::pauseQuietHour(QUIET_HOUR_PAUSE);
         } else {
-          strip.done(0, Timing::getDate(), &networkHelper);
+          strip.done(habit, 0);
+          pressToggled[habit] = true;
+
+          // every press extends the window, a burst is flushed once it is over
+          Scheduler* scheduler = Timing::getScheduler();
+          if (scheduler->isPending(flushTimer)) {
+            scheduler->reschedule(flushTimer, FLUSH_DELAY);
+          } else {
+            flushTimer = scheduler->setTimeout(FLUSH_DELAY, flushPresses, NULL);
+          }
         }
       }
     }
+
+    // Button is held: switch the strip between days and month completion
+    if (currentButtonState[habit] == LOW && ! longPressHandled[habit]
+        && (millis() - pressStart[habit]) > longPressDelay) {
+      longPressHandled[habit] = true;
+      if (pressToggled[habit]) {
+        // toggling again cancels the press, nothing goes to the backend
+        strip.done(habit, 0);
+      }
+      strip.setMonthMode(! strip.getMonthMode());
+      LOG_INFO("Month mode: %d", strip.getMonthMode());
+      strip.visualize();
+    }
   }
 
-  lastButtonState = readButton;
+  lastButtonState[habit] = reading;
 }
 
-// Triggered every day by the ezTime events()
-void everyDay() {
-  Serial.println("Next Day. Shifting pixelHistory...");
+// Triggered every day by the scheduler
+void everyDay(void*) {
+  LOG_INFO("Next Day. Shifting pixelHistory...");
 
-  strip.newDay(Timing::getDate());
+  strip.newDay(Timing::getDay());
   strip.visualize();
 }
 
-// Triggered every 5 Minutes by the ezTime events()
-void fullSync() {
-  Serial.println("Syncing to backend...");
-
-  Serial.print("Free memory: ");
-  Serial.println(NetworkHelper::freeMemory());
+// Triggered every SYNC_INTERVAL minutes by the scheduler
+void fullSync(void*) {
+  LOG_INFO("Syncing to backend...");
+  LOG_DEBUG("Free memory: %d", NetworkHelper::freeMemory());
 
   strip.sync(&networkHelper);
 }
 
+// Triggered by the scheduler once button presses have settled
+void flushPresses(void*) {
+  LOG_INFO("Flushing button presses...");
+
+  strip.flush(&networkHelper);
+}
+
 void quietHour(bool isQuietHour) {
-    Serial.print("Quiet Hour is active: ");
-    Serial.println(isQuietHour);
+    LOG_INFO("Quiet Hour is active: %d", isQuietHour);
 
     strip.setQuietHours(isQuietHour);
 }
 
 void initLog() {
-  Serial.begin(9600);
+  Log::begin(9600);
   if(WAIT_FOR_SERIAL) {
     while (!Serial) {
       ; // wait for serial port to connect. Needed for native USB port only
     }
   }
-  Serial.println("Hello Serial");
+  LOG_INFO("Hello Serial");
 }
 
 void requireLoop() {
-  bool requirementMissing = false;
-  // wait for wifi connection
-  while(! NetworkHelper::isWifiConnected()) {
-    requirementMissing = true;
-    strip.advanceLoadingAnimation();
+  // Bring-up never blocks the loop: wifi association, time and the first sync overlap
+  // with button handling and the frame engine, each step starts as soon as it can.
+  if (! NetworkHelper::isWifiConnected()) {
+    online = false;
+    syncFailed = false;
+    strip.setLoading(true);
+    // rate limited, only starts a connection attempt
     NetworkHelper::connectWifi(SECRET_SSID, SECRET_PASS);
-    delay(5000);
   }
 
-  // wait for wifi time 
-  while(! NetworkHelper::isWifiTimeAvailable()) {
-    requirementMissing = true;
-    strip.advanceLoadingAnimation();
-    delay(500);
+  // seed the time from the wifi module as soon as it has one, no need to wait for an NTP round
+  if (! Timing::isSynced() && NetworkHelper::isWifiConnected()) {
+    Timing::setTime(NetworkHelper::getWifiTime());
   }
 
-  // wait for eztime sync
-  while(!Timing::isSynced()) {
-      requirementMissing = true;
-      strip.advanceLoadingAnimation();
+  if (! Timing::isSynced()) {
+    strip.setLoading(true);
+    return;
+  }
 
-      Timing::syncTime();
+  if (! started) {
+    // the time is known (RTC or wifi): show the current day and start the timers
+    strip.newDay(Timing::getDay());
 
-      delay(5000);
+    syncTimer = Timing::onInterval(SYNC_INTERVAL, fullSync, NULL);
+    dayTimer = Timing::onNextDay(everyDay, NULL);
+    Timing::onQuietHour(QUIET_HOUR_START, QUIET_HOUR_END, quietHour);
+    started = true;
   }
 
-  if (requirementMissing) {
-    // Verify backend
-    Serial.print("Free memory: ");
-    Serial.println(NetworkHelper::freeMemory());
+  if (! online && NetworkHelper::isWifiConnected()
+      && (! syncFailed || (millis() - lastSyncAttempt) > SYNC_RETRY_DELAY)) {
+    NetworkHelper::printWifiStatus();
+    LOG_DEBUG("Free memory: %d", NetworkHelper::freeMemory());
     // networkHelper.testBackend("test backend #1");
 
-    // init strip by setting first day and syncing with backend
-    strip.newDay(Timing::getDate());
-    fullSync();
+    // sync with backend right after (re)connecting, keep the timers running
+    // only a successful sync counts as online, until then the watch request stays off
+    lastSyncAttempt = millis();
+    fullSync(NULL);
+    syncFailed = networkHelper.getLastError() != NetworkHelper::OK;
+    if (syncFailed) {
+      LOG_WARN("Sync after connecting failed, retrying in %lu ms", SYNC_RETRY_DELAY);
+      return;
+    }
+    online = true;
 
-    // setup timing event callbacks
-    Timing::onInterval(SYNC_INTERVAL, fullSync);
-    Timing::onNextDay(everyDay);
-    Timing::onQuietHour(QUIET_HOUR_START, QUIET_HOUR_END, quietHour);
+    if (! bootReported) {
+      LOG_INFO("Reset to rendered strip: %lu ms", millis());
+      bootReported = true;
+    }
   }
-}
\ No newline at end of file
+}
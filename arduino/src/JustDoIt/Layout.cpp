@@ -0,0 +1,86 @@
+#include "Layout.h"
+
+RingLayout::RingLayout(int _pixelCount)
+    : pixelCount(_pixelCount) {
+}
+
+int RingLayout::getPixelCount() const {
+    return pixelCount;
+}
+
+int RingLayout::getDayCount() const {
+    return pixelCount;
+}
+
+int RingLayout::getPixel(int index, long) const {
+    // fill backwards except for current day, which is on the first pixel.
+    // With 60 pixels:
+    // 0 ->  0
+    // 1 -> 59
+    // 2 -> 58
+    // 3 -> 57
+    if (index < 0 || index >= pixelCount) {
+        return -1;
+    }
+    return index == 0 ? 0 : pixelCount - index;
+}
+
+LinearLayout::LinearLayout(int _pixelCount)
+    : pixelCount(_pixelCount) {
+}
+
+int LinearLayout::getPixelCount() const {
+    return pixelCount;
+}
+
+int LinearLayout::getDayCount() const {
+    return pixelCount;
+}
+
+int LinearLayout::getPixel(int index, long) const {
+    if (index < 0 || index >= pixelCount) {
+        return -1;
+    }
+    return index;
+}
+
+MatrixLayout::MatrixLayout(int _columns, int _rows)
+    : columns(_columns),
+      rows(_rows) {
+}
+
+int MatrixLayout::getPixelCount() const {
+    return columns * rows;
+}
+
+int MatrixLayout::getDayCount() const {
+    return columns * rows;
+}
+
+int MatrixLayout::getPixel(int index, long today) const {
+    // With 7 rows, today is in the row of its weekday (1970-01-01 was a Thursday),
+    // otherwise the days just fill the columns with today on the last pixel
+    int todayRow = rows == 7 ? (today + 3) % 7 : rows - 1;
+    int cell = (columns - 1) * rows + todayRow - index;
+    if (index < 0 || cell < 0) {
+        return -1;
+    }
+
+    int column = cell / rows;
+    int row = cell % rows;
+    if (column % 2 == 1) {
+        row = rows - 1 - row;
+    }
+    return column * rows + row;
+}
+
+bool MatrixLayout::isBlank(int pixel, long today) const {
+    // the days after today in the current week, they are in the last column below today
+    int todayRow = rows == 7 ? (today + 3) % 7 : rows - 1;
+    int column = pixel / rows;
+    int row = pixel % rows;
+    if (column % 2 == 1) {
+        row = rows - 1 - row;
+    }
+    return column == columns - 1 && row > todayRow;
+}
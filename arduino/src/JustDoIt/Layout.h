@@ -0,0 +1,67 @@
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#include <Arduino.h>
+
+/*
+* Maps the days of a habit to the pixels of its segment.
+* Day index 0 is today, index i is i days ago.
+*/
+class Layout {
+    public:
+        virtual ~Layout() {}
+
+        // pixels of one habit segment
+        virtual int getPixelCount() const = 0;
+        // days kept per habit, at least the number of days that can be visible at once
+        virtual int getDayCount() const = 0;
+        // pixel within the segment, -1 if the day is not visible today
+        virtual int getPixel(int index, long today) const = 0;
+        // pixel within the segment that shows no day today, it is kept off
+        virtual bool isBlank(int, long) const { return false; }
+};
+
+// Ring: today on the first pixel, older days run backwards around the ring
+class RingLayout : public Layout {
+    public:
+        RingLayout(int);
+
+        int getPixelCount() const;
+        int getDayCount() const;
+        int getPixel(int, long) const;
+
+    private:
+        int pixelCount;
+};
+
+// Linear strip: today on the first pixel, older days follow along the strip
+class LinearLayout : public Layout {
+    public:
+        LinearLayout(int);
+
+        int getPixelCount() const;
+        int getDayCount() const;
+        int getPixel(int, long) const;
+
+    private:
+        int pixelCount;
+};
+
+// Matrix: one column per week (Monday on top) if it has 7 rows, the current week in the last column.
+// The pixels are wired in a serpentine, down the first column and up the next one.
+// 53 x 7 shows a full year calendar.
+class MatrixLayout : public Layout {
+    public:
+        MatrixLayout(int columns, int rows);
+
+        int getPixelCount() const;
+        int getDayCount() const;
+        int getPixel(int, long) const;
+        bool isBlank(int, long) const;
+
+    private:
+        int columns;
+        int rows;
+};
+
+#endif
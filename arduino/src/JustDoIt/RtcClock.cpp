@@ -0,0 +1,65 @@
+#include "RtcClock.h"
+
+const unsigned long RtcClock::MIN_VALID_TIME = 1577836800UL;  // 2020-01-01, anything before is left over from a power-on reset
+
+void RtcClock::begin() {
+    // The generic clock is reset with the chip, the RTC itself is not: connect the clock first
+    initClock();
+
+    // Only a reset that kept the supply up leaves a running counter behind
+    bool keepTime = (PM->RCAUSE.reg & (PM_RCAUSE_SYST | PM_RCAUSE_WDT | PM_RCAUSE_EXT))
+        && RTC->MODE0.CTRL.bit.ENABLE
+        && RTC->MODE0.CTRL.bit.MODE == RTC_MODE0_CTRL_MODE_COUNT32_Val;
+    if (keepTime) {
+        return;
+    }
+
+    RTC->MODE0.CTRL.reg &= ~RTC_MODE0_CTRL_ENABLE;
+    waitForSync();
+    RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_SWRST;
+    waitForSync();
+
+    // 1024Hz from the generic clock, divided down to one count per second
+    RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32 | RTC_MODE0_CTRL_PRESCALER_DIV1024;
+    waitForSync();
+    RTC->MODE0.COUNT.reg = 0;
+    waitForSync();
+    RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_ENABLE;
+    waitForSync();
+}
+
+bool RtcClock::isValid() {
+    return now() >= MIN_VALID_TIME;
+}
+
+unsigned long RtcClock::now() {
+    RTC->MODE0.READREQ.reg = RTC_READREQ_RREQ;
+    waitForSync();
+    return RTC->MODE0.COUNT.reg;
+}
+
+void RtcClock::setTime(unsigned long utc) {
+    RTC->MODE0.COUNT.reg = utc;
+    waitForSync();
+}
+
+void RtcClock::initClock() {
+    PM->APBAMASK.reg |= PM_APBAMASK_RTC;
+
+    // GCLK2 runs at 32768Hz / 2^(4+1) = 1024Hz
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(2) | GCLK_GENDIV_DIV(4);
+    while (GCLK->STATUS.bit.SYNCBUSY);
+#ifdef CRYSTALLESS
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_OSCULP32K | GCLK_GENCTRL_ID(2) | GCLK_GENCTRL_DIVSEL;
+#else
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_XOSC32K | GCLK_GENCTRL_ID(2) | GCLK_GENCTRL_DIVSEL;
+#endif
+    while (GCLK->STATUS.bit.SYNCBUSY);
+
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2 | GCLK_CLKCTRL_ID(RTC_GCLK_ID);
+    while (GCLK->STATUS.bit.SYNCBUSY);
+}
+
+void RtcClock::waitForSync() {
+    while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+}
@@ -0,0 +1,26 @@
+#ifndef _RTC_CLOCK_H_
+#define _RTC_CLOCK_H_
+
+#include <Arduino.h>
+
+/*
+* Wall clock time in the SAMD21 RTC: a 32 bit counter of UTC seconds running from the 32kHz oscillator.
+* The RTC keeps counting through external, watchdog and system resets,
+* so after such a reset the time is available right away instead of after WiFi and NTP.
+* A power-on reset clears it, then the time is invalid until it is set again.
+*/
+class RtcClock {
+    public:
+        static void begin();
+        static bool isValid();
+        static unsigned long now();
+        static void setTime(unsigned long utc);
+
+    private:
+        static const unsigned long MIN_VALID_TIME;
+
+        static void initClock();
+        static void waitForSync();
+};
+
+#endif
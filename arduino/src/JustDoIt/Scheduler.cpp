@@ -0,0 +1,223 @@
+#include "Scheduler.h"
+
+
+Scheduler::Scheduler()
+ :timers{NULL},
+  heap{NULL},
+  capacity{0},
+  firstFree{-1},
+  heapSize{0} {
+}
+
+Scheduler::Handle Scheduler::setTimeout(unsigned long delayMillis, TimerCallback callback, void* context) {
+    return add(delayMillis, 0, callback, context);
+}
+
+Scheduler::Handle Scheduler::setInterval(unsigned long periodMillis, TimerCallback callback, void* context) {
+    if (periodMillis == 0) {
+        return INVALID_HANDLE;
+    }
+    return add(periodMillis, periodMillis, callback, context);
+}
+
+bool Scheduler::reschedule(Handle handle, unsigned long delayMillis) {
+    int slot = slotOf(handle);
+    if (slot < 0) {
+        return false;
+    }
+
+    timers[slot].due = millis() + delayMillis;
+    siftUp(timers[slot].heapIndex);
+    siftDown(timers[slot].heapIndex);
+    return true;
+}
+
+bool Scheduler::cancel(Handle handle) {
+    int slot = slotOf(handle);
+    if (slot < 0) {
+        return false;
+    }
+
+    remove(slot);
+    return true;
+}
+
+bool Scheduler::isPending(Handle handle) {
+    return slotOf(handle) >= 0;
+}
+
+void Scheduler::run() {
+    // bound the work per call, so a timer can't starve the loop
+    int maxCalls = heapSize;
+    for (int calls=0; calls<maxCalls && heapSize>0; calls++) {
+        int slot = heap[0];
+        Timer* timer = &timers[slot];
+
+        unsigned long now = millis();
+        if (isBefore(now, timer->due)) {
+            return;
+        }
+
+        TimerCallback callback = timer->callback;
+        void* context = timer->context;
+
+        if (timer->period > 0) {
+            // re-arm before the callback runs, so it may cancel or reschedule itself
+            timer->due += timer->period;
+            if (isBefore(timer->due, now)) {
+                // skip missed periods instead of firing them in a burst
+                timer->due = now + timer->period;
+            }
+            siftDown(0);
+        } else {
+            remove(slot);
+        }
+
+        callback(context);
+    }
+}
+
+Scheduler::Handle Scheduler::add(unsigned long delayMillis, unsigned long periodMillis, TimerCallback callback, void* context) {
+    if (callback == NULL) {
+        return INVALID_HANDLE;
+    }
+    if (heapSize == capacity && ! grow()) {
+        LOG_ERROR("Scheduler: no room for another timer (%d)", capacity);
+        return INVALID_HANDLE;
+    }
+
+    int slot = firstFree;
+    Timer* timer = &timers[slot];
+    firstFree = timer->nextFree;
+
+    timer->due = millis() + delayMillis;
+    timer->period = periodMillis;
+    timer->callback = callback;
+    timer->context = context;
+    timer->heapIndex = heapSize;
+
+    heap[heapSize] = slot;
+    heapSize++;
+    siftUp(timer->heapIndex);
+
+    return (timer->generation << 16) | slot;
+}
+
+bool Scheduler::grow() {
+    int newCapacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+    if (newCapacity > MAX_TIMERS) {
+        newCapacity = MAX_TIMERS;
+    }
+    if (newCapacity <= capacity) {
+        return false;
+    }
+
+    Timer* newTimers = (Timer*) realloc(timers, newCapacity * sizeof(Timer));
+    if (newTimers == NULL) {
+        return false;
+    }
+    timers = newTimers;
+
+    uint16_t* newHeap = (uint16_t*) realloc(heap, newCapacity * sizeof(uint16_t));
+    if (newHeap == NULL) {
+        // the larger timer table is kept, the capacity follows the smaller heap
+        return false;
+    }
+    heap = newHeap;
+
+    // the new slots go to the front of the free list, lowest slot first
+    for (int i=newCapacity-1; i>=capacity; i--) {
+        timers[i].generation = 1;
+        timers[i].heapIndex = -1;
+        timers[i].nextFree = firstFree;
+        firstFree = i;
+    }
+    capacity = newCapacity;
+    return true;
+}
+
+int Scheduler::slotOf(Handle handle) {
+    int slot = handle & 0xffff;
+    if (slot >= capacity) {
+        return -1;
+    }
+
+    Timer* timer = &timers[slot];
+    if (timer->heapIndex < 0 || timer->generation != (handle >> 16)) {
+        return -1;
+    }
+    return slot;
+}
+
+void Scheduler::remove(int slot) {
+    int i = timers[slot].heapIndex;
+
+    // invalidate all handles to this slot
+    timers[slot].heapIndex = -1;
+    timers[slot].generation++;
+    if (timers[slot].generation > 0xffff) {
+        timers[slot].generation = 1;
+    }
+    timers[slot].nextFree = firstFree;
+    firstFree = slot;
+
+    heapSize--;
+    if (i == heapSize) {
+        return;
+    }
+
+    int moved = heap[heapSize];
+    heap[i] = moved;
+    timers[moved].heapIndex = i;
+    siftUp(i);
+    siftDown(timers[moved].heapIndex);
+}
+
+bool Scheduler::isBefore(unsigned long a, unsigned long b) {
+    // overflow safe comparison of millis() timestamps
+    return (long)(a - b) < 0;
+}
+
+bool Scheduler::less(int i, int j) {
+    return isBefore(timers[heap[i]].due, timers[heap[j]].due);
+}
+
+void Scheduler::swap(int i, int j) {
+    uint16_t slot = heap[i];
+    heap[i] = heap[j];
+    heap[j] = slot;
+    timers[heap[i]].heapIndex = i;
+    timers[heap[j]].heapIndex = j;
+}
+
+void Scheduler::siftUp(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!less(i, parent)) {
+            return;
+        }
+        swap(i, parent);
+        i = parent;
+    }
+}
+
+void Scheduler::siftDown(int i) {
+    while (true) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < heapSize && less(left, smallest)) {
+            smallest = left;
+        }
+        if (right < heapSize && less(right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+
+        swap(i, smallest);
+        i = smallest;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <Arduino.h>
+#include <Log.h>
+
+typedef void (*TimerCallback)(void* context);
+
+/*
+* One-shot and periodic timers on top of millis(), kept in a binary min-heap.
+* Adding, rescheduling and cancelling a timer is O(log n), checking for due timers is O(1).
+* Handles carry a generation counter, so a stale handle never hits a reused slot.
+* The timer table starts small and doubles when it is full. If memory runs out,
+* or all MAX_TIMERS slots are taken, adding a timer returns INVALID_HANDLE.
+*/
+class Scheduler {
+    public:
+        typedef uint32_t Handle;
+        static const Handle INVALID_HANDLE = 0;
+        static const int INITIAL_CAPACITY = 8;
+        static const int MAX_TIMERS = 0xffff;  // slots addressable by a handle
+
+        Scheduler();
+
+        Handle setTimeout(unsigned long delayMillis, TimerCallback callback, void* context);
+        Handle setInterval(unsigned long periodMillis, TimerCallback callback, void* context);
+        bool reschedule(Handle handle, unsigned long delayMillis);
+        bool cancel(Handle handle);
+        bool isPending(Handle handle);
+
+        void run();
+
+    private:
+        struct Timer {
+            unsigned long due;
+            unsigned long period;  // 0 for one-shot timers
+            TimerCallback callback;
+            void* context;
+            uint32_t generation;
+            int heapIndex;  // -1 if the slot is free
+            int nextFree;   // next free slot while this one is free, -1 at the end of the list
+        };
+
+        Timer* timers;
+        uint16_t* heap;  // slot indices ordered by due time
+        int capacity;
+        int firstFree;  // free slots form a list, so adding a timer doesn't search for one
+        int heapSize;
+
+        Handle add(unsigned long delayMillis, unsigned long periodMillis, TimerCallback callback, void* context);
+        bool grow();
+        int slotOf(Handle handle);
+        void remove(int slot);
+        static bool isBefore(unsigned long a, unsigned long b);
+        bool less(int i, int j);
+        void swap(int i, int j);
+        void siftUp(int i);
+        void siftDown(int i);
+};
+
+#endif
@@ -5,54 +5,75 @@
 #include <ArduinoJson.h>
 #include <math.h>
 
-Strip::Strip(int _pixelCount, int pixelPin, int brightness) 
-    : pixelCount(_pixelCount),
-      loadingAnimationPixel{0},
-      awake{true},
-      strip(_pixelCount, pixelPin, NEO_GRB + NEO_KHZ800) {
+const int Strip::WATCH_TIMEOUT = 45;  // below the 60s read timeout of common reverse proxies
+const unsigned long Strip::WATCH_RETRY_DELAY = 60000;
 
-        strip.begin();
-        strip.setBrightness(brightness);
-        strip.show();
+Strip::Strip(const Layout* _layout, int pixelPin, int brightness, const char* const habitNames[], int _habitCount) 
+    : layout(_layout),
+      pixelCount(_layout->getPixelCount() * _habitCount),
+      habitCount(_habitCount),
+      awake{true},
+      monthMode{false},
+      watching{false},
+      watchStart{0},
+      watchVersion{0},
+      syncCursor{0},
+      frames(_layout->getPixelCount() * _habitCount, pixelPin, brightness) {
+
+        // One segment per habit, all with the same layout
+        int segmentLength = layout->getPixelCount();
+        habits = new Habit[habitCount];
+        for (int h=0; h<habitCount; h++) {
+            habits[h].init(habitNames[h], h * segmentLength, layout->getDayCount());
+        }
+}
 
-        data = new It[pixelCount];
+void Strip::begin() {
+    // start rendering frames in the background
+    frames.begin();
 }
 
-void Strip::newDay(String date) {
-    // Free memory of it that falls of the table!
-    data[pixelCount - 1].destroy();
+int Strip::getHabitCount() {
+    return habitCount;
+}
 
-    // Shift all pixels to the 'right' (last pixel will be dropped)
-    for (int i=pixelCount-1; i>0; i--) {
-        data[i] = data[i-1];
+void Strip::newDay(long day) {
+    for (int h=0; h<habitCount; h++) {
+        habits[h].newDay(day);
     }
 
-    // Set todays pixel
-    data[0] = It();
-    data[0].setDate(date);
-    data[0].setDone(false);
-    data[0].setSynced(true);
-
     freshDay = true;
 }
 
-void Strip::done(int index, String date, NetworkHelper* networkHelper) {
-    data[index].setDate(date);
-    data[index].setDone(! data[index].isDone());
-    data[index].setSynced(false);
-    if(data[index].isDone() && index < pixelCount - 1) {
-      // continue streak calculation in case backend is offline
-      data[index].setStreak( data[index+1].getStreak() + 1 );
+void Strip::done(int habit, int index) {
+    // Applied locally at once: the streak is derived from the local bitmap, so the color is right
+    // immediately, even offline. Pressing twice cancels out in the pending bitmap.
+    habits[habit].toggle(index);
+    visualize();
+}
+
+bool Strip::hasPending() {
+    for (int h=0; h<habitCount; h++) {
+      if (habits[h].hasPending()) {
+        return true;
+      }
+    }
+    return false;
+}
+
+void Strip::flush(NetworkHelper* networkHelper) {
+    // presses that cancelled each other out don't cost a connection
+    if (! hasPending()) {
+      return;
     }
 
-    // sync pending -> green
-    setPixelPending(index);
-    strip.show();
+    // the connection is needed for the changes
+    stopWatch(networkHelper);
 
+    // one connection for the net change of all habits and days, the user just pressed the button
+    networkHelper->setBudget(&NetworkHelper::INTERACTIVE_BUDGET);
     if(networkHelper->connectBackend()) {
-      if(data[index].postIt(networkHelper)) {
-        data[index].getStreak(networkHelper);
-      }
+      syncUp(networkHelper);
 
       networkHelper->disconnectBackend();
     }
@@ -61,36 +82,171 @@ void Strip::done(int index, String date, NetworkHelper* networkHelper) {
 }
 
 void Strip::sync(NetworkHelper* networkHelper) {
-    Serial.println("Sync");
-    Serial.print("Free memory: ");
-    Serial.println(NetworkHelper::freeMemory());
+    LOG_DEBUG("Sync, free memory: %d", NetworkHelper::freeMemory());
 
-    advanceLoadingAnimation();
+    setLoading(true);
+    stopWatch(networkHelper);
 
+    networkHelper->setBudget(&NetworkHelper::BACKGROUND_BUDGET);
     if(networkHelper->connectBackend()) {
-      for(int i=0; i<pixelCount; i++) {
-        advanceLoadingAnimation();
-        if(data[i].postIt(networkHelper)) {
-          if (! data[i].getIt(i, data[0].getDate(), networkHelper)) {
-            // assume backend is offline
-            break;
-          }
-        }
+      // a lost connection leaves the rest for the next attempt, the window would fail anyway
+      if (syncUp(networkHelper)) {
+        // a single request returns window state and carried streaks of all habits
+        syncDown(networkHelper);
       }
 
-      advanceLoadingAnimation();
-
-      // to calculate the current streak, get the pre-calculated streaks from the backend
-      // for today and yesterday (in case today has not been done yet; to allow for offline calculation of today streak).
-      data[0].getStreak(networkHelper);
-      data[1].getStreak(networkHelper);
-
       networkHelper->disconnectBackend();
     }
 
+    setLoading(false);
     visualize();
 }
 
+bool Strip::syncUp(NetworkHelper* networkHelper) {
+    // only days changed locally cause a request, independent of the number of habits.
+    // Resume with the habit where the last attempt lost the connection, so every habit gets its turn.
+    for (int i=0; i<habitCount; i++) {
+      int h = (syncCursor + i) % habitCount;
+      if (! habits[h].syncUp(networkHelper, &watchVersion) && ! networkHelper->isBackendConnected()) {
+        LOG_INFO("Sync stopped at habit %s", habits[h].getName());
+        syncCursor = h;
+        return false;
+      }
+    }
+
+    syncCursor = 0;
+    return true;
+}
+
+bool Strip::syncDown(NetworkHelper* networkHelper) {
+    int dayCount = habits[0].getDayCount();
+
+    long today = habits[0].getToday();
+    long monthStart = Calendar::monthStart(today);
+
+    DynamicJsonDocument requestDoc(
+      JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(habitCount) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(2)
+    );
+    // keys and habit names are copied from the response buffer
+    size_t stringSize = sizeof("habits") + sizeof("version");
+    for (int h=0; h<habitCount; h++) {
+      stringSize += sizeof("bits") + sizeof("carry") + sizeof("name") + sizeof("stats")
+        + sizeof("done") + sizeof("days") + sizeof("longest") + strlen(habits[h].getName()) + 1;
+    }
+    DynamicJsonDocument responseDoc(
+      JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(habitCount)
+      + habitCount * (JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE((dayCount + 31) / 32)
+        + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(3))
+      + stringSize
+    );
+
+    requestDoc["day"] = today;
+    requestDoc["count"] = dayCount;
+    JsonArray names = requestDoc.createNestedArray("habits");
+    for (int h=0; h<habitCount; h++) {
+      names.add(habits[h].getName());
+    }
+
+    // the days of this month older than the window, for the month completion (empty if the window covers the month)
+    JsonObject range = requestDoc.createNestedArray("ranges").createNestedObject();
+    range["from"] = monthStart;
+    range["to"] = today - dayCount;
+
+    if(networkHelper->postRequest("/habits/sync", &requestDoc, &responseDoc)) {
+      watchVersion = responseDoc["version"] | watchVersion;
+
+      JsonArray windows = responseDoc["habits"];
+      for (int h=0; h<habitCount && h<windows.size(); h++) {
+        habits[h].applyWindow(windows[h], monthStart);
+      }
+      return true;
+    }
+
+    return false;
+}
+
+void Strip::watch(NetworkHelper* networkHelper) {
+    // Keep a long poll parked on the backend, so changes from other clients show up within seconds
+    if (watching) {
+        if (networkHelper->isResponseAvailable()) {
+            if (finishWatch(networkHelper)) {
+                sync(networkHelper);
+            }
+        } else if (millis() - watchStart > (WATCH_TIMEOUT + 15) * 1000UL) {
+            // the backend should have answered long ago, the connection is probably gone
+            LOG_WARN("Watch request timed out");
+            stopWatch(networkHelper);
+        }
+        return;
+    }
+
+    // don't hammer a backend that refused the last watch request
+    if (networkHelper->getLastError() != NetworkHelper::OK && millis() - watchStart < WATCH_RETRY_DELAY) {
+        return;
+    }
+
+    startWatch(networkHelper);
+}
+
+bool Strip::startWatch(NetworkHelper* networkHelper) {
+    DynamicJsonDocument requestDoc(JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(habitCount));
+    requestDoc["version"] = watchVersion;
+    requestDoc["timeout"] = WATCH_TIMEOUT;
+    JsonArray names = requestDoc.createNestedArray("habits");
+    for (int h=0; h<habitCount; h++) {
+      names.add(habits[h].getName());
+    }
+
+    watchStart = millis();
+    networkHelper->setBudget(&NetworkHelper::BACKGROUND_BUDGET);
+
+    // the previous watch may have left its connection open
+    if (! networkHelper->isBackendConnected() && ! networkHelper->connectBackend()) {
+      return false;
+    }
+
+    watching = networkHelper->sendRequest("POST", "/habits/watch", &requestDoc);
+    if (! watching) {
+      networkHelper->abortRequest();
+    }
+    return watching;
+}
+
+bool Strip::finishWatch(NetworkHelper* networkHelper) {
+    // keys and habit names are copied from the response buffer: "version", "changed" and every watched name
+    size_t stringSize = sizeof("version") + sizeof("changed");
+    for (int h=0; h<habitCount; h++) {
+      stringSize += strlen(habits[h].getName()) + 1;
+    }
+    DynamicJsonDocument responseDoc(JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(habitCount) + stringSize);
+
+    // the answer is on its way, read it within the usual budget
+    watching = false;
+    networkHelper->setBudget(&NetworkHelper::BACKGROUND_BUDGET);
+    if (! networkHelper->receiveResponse(&responseDoc)) {
+      networkHelper->abortRequest();
+      return false;
+    }
+
+    // keep the connection for the next watch request, unless there is a sync to do
+    long version = responseDoc["version"] | watchVersion;
+    if (version == watchVersion) {
+      return false;
+    }
+
+    LOG_INFO("Backend changed: version %ld", version);
+    networkHelper->disconnectBackend();
+    return true;
+}
+
+void Strip::stopWatch(NetworkHelper* networkHelper) {
+    // a parked request or a connection kept open for the next one
+    if (watching || networkHelper->isBackendConnected()) {
+      networkHelper->abortRequest();
+    }
+    watching = false;
+}
+
 void Strip::setAwake(bool a) {
     awake = a;
 }
@@ -104,67 +260,93 @@ bool Strip::getQuietHours() {
     return quietHours;
 }
 
-void Strip::show() {
-    strip.show();
+void Strip::setLoading(bool isLoading) {
+    // the spinner is animated by the frame engine, independent of what blocks the loop
+    frames.setLoading(isLoading && awake && !quietHours);
 }
 
-void Strip::advanceLoadingAnimation() {
-    setPixelLoading(loadingAnimationPixel);
-    setPixelUndone(loadingAnimationPixel - 1);
-    loadingAnimationPixel += 1;
-    strip.show();
+void Strip::setMonthMode(bool isMonthMode) {
+    monthMode = isMonthMode;
+}
+
+bool Strip::getMonthMode() {
+    return monthMode;
 }
 
 void Strip::visualize() {
-    int streak = data[0].getStreak();
-
-    for (int i=0; i<pixelCount; i++) {
-        if (streak > 0) 
-            streak --;
-
-        if (! data[i].isSynced() ) {
-            setPixelPending(i);
-        } else if ( i == 0 && ! data[i].isDone()) {
-            setPixelTodo(i);
-        } else if ( data[i].isDone() ){
-            setPixelDone(i, streak);
-        } else {
-            setPixelUndone(i);
+    for (int h=0; h<habitCount; h++) {
+        if (monthMode) {
+            visualizeMonth(h);
+            continue;
+        }
+
+        Habit* habit = &habits[h];
+        int streak = habit->isDone(0) ? habit->getStreak(0) : 0;
+
+        for (int i=0; i<habit->getDayCount(); i++) {
+            if (streak > 0) 
+                streak --;
+
+            int pixelIndex = translatePixelLocation(h, i);
+            if ( pixelIndex < 0 ) {
+                // not visible today, but still part of the streak
+                continue;
+            } else if ( habit->isPending(i) ) {
+                setPixelPending(pixelIndex);
+            } else if ( i == 0 && ! habit->isDone(i)) {
+                setPixelTodo(pixelIndex);
+            } else if ( habit->isDone(i) ){
+                setPixelDone(pixelIndex, streak);
+            } else {
+                setPixelUndone(pixelIndex);
+            }
+        }
+
+        // pixels without a day, e.g. the rest of the current week, must not keep the colors of another day or month mode
+        for (int p=0; p<layout->getPixelCount(); p++) {
+            if (layout->isBlank(p, habit->getToday())) {
+                frames.setPixelColor(habit->getFirstPixel() + p, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
+            }
         }
     }
-    strip.show();
 }
 
-int Strip::translatePixelLocation(int index) {
-  // fill pixel ring backwards except for current day, which is on first pixel (0).
-  // 0 ->  0
-  // 1 -> 59
-  // 2 -> 58
-  // 3 -> 57
-  
-  int pixelIndex = 0;
+void Strip::visualizeMonth(int h) {
+    // The segment is a bar of the days done this month, relative to the days of the month so far
+    Habit* habit = &habits[h];
+    long monthStart = Calendar::monthStart(habit->getToday());
+    int days = habit->getToday() - monthStart + 1;
+    int segmentLength = layout->getPixelCount();
+    int lit = (long)segmentLength * habit->getMonthDone(monthStart) / days;
+
+    for (int p=0; p<segmentLength; p++) {
+        int pixelIndex = habit->getFirstPixel() + p;
+        if (p < lit && awake && !quietHours) {
+            frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 64,  16));  // green
+        } else {
+            frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
+        }
+    }
+}
 
-  int arrayIndex = index % pixelCount;
-  if (arrayIndex != 0) {
-    pixelIndex = pixelCount - arrayIndex;
+int Strip::translatePixelLocation(int habit, int index) {
+  int pixelIndex = layout->getPixel(index, habits[habit].getToday());
+  if (pixelIndex < 0) {
+    return -1;
   }
 
-  return pixelIndex;
+  return habits[habit].getFirstPixel() + pixelIndex;
 }
 
-void Strip::setPixelPending(int arrayIndex) {
-  int pixelIndex = translatePixelLocation(arrayIndex);
-
+void Strip::setPixelPending(int pixelIndex) {
   if(awake && !quietHours) {
-    strip.setPixelColor(pixelIndex, strip.Color(  64, 64,   0));  // yellow
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  64, 64,   0));  // yellow
   } else {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
   }
 }
 
-void Strip::setPixelDone(int arrayIndex, int streak) {
-  int pixelIndex = translatePixelLocation(arrayIndex);
-  
+void Strip::setPixelDone(int pixelIndex, int streak) {
   if(awake && !quietHours) {
     // start at turquoise -> blue -> red -> green -> ...
     int hue = 65536 / 2 + streak * 180;
@@ -173,40 +355,26 @@ void Strip::setPixelDone(int arrayIndex, int streak) {
     if (streak == 0)
       brightness = 30;
 
-    strip.setPixelColor(pixelIndex, strip.gamma32(strip.ColorHSV(hue, saturation, brightness)));
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::gamma32(Adafruit_NeoPixel::ColorHSV(hue, saturation, brightness)));
   } else {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
   }
 }
 
-void Strip::setPixelUndone(int arrayIndex) {
-  int pixelIndex = translatePixelLocation(arrayIndex);
-  
+void Strip::setPixelUndone(int pixelIndex) {
   if(awake && !quietHours) {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
   } else {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
   }
 }
 
-void Strip::setPixelTodo(int arrayIndex) {
-  int pixelIndex = translatePixelLocation(arrayIndex);
-  
+void Strip::setPixelTodo(int pixelIndex) {
   // Don't check for quiet hours -> ALWAYS show TODO pixels!
   // EXCEPT when a new day has started (middle of the night)
   if(awake && !freshDay) {
-    strip.setPixelColor(pixelIndex, strip.Color(  230, 40,   0));  // redish
-  } else {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
-  }
-}
-
-void Strip::setPixelLoading(int arrayIndex) {    
-  int pixelIndex = translatePixelLocation(arrayIndex);
-  
-  if(awake && !quietHours) {
-    strip.setPixelColor(pixelIndex, strip.Color(  127, 0,   0));  // red
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  230, 40,   0));  // redish
   } else {
-    strip.setPixelColor(pixelIndex, strip.Color(  0, 0,   0));  // off
+    frames.setPixelColor(pixelIndex, Adafruit_NeoPixel::Color(  0, 0,   0));  // off
   }
 }
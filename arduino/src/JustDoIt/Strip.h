@@ -1,44 +1,65 @@
 #ifndef _STRIP_H_
 #define _STRIP_H_
 
-#include "It.h"
+#include "Habit.h"
+#include "FrameEngine.h"
+#include "Layout.h"
+#include "Calendar.h"
 #include <Arduino.h>
 #include <NetworkHelper.h>
 #include <Adafruit_NeoPixel.h>
 
 class Strip {
     public:
-        Strip(int, int, int);
+        Strip(const Layout*, int, int, const char* const[], int);
 
+        void begin();
         void setAwake(bool);
         void setQuietHours(bool);
         bool getQuietHours();
 
         void visualize();
-        void show();
-        void newDay(String);
-        void done(int, String, NetworkHelper*);
+        void newDay(long);
+        void done(int, int);
+        bool hasPending();
+        void flush(NetworkHelper*);
         void sync(NetworkHelper*);
-        void advanceLoadingAnimation();
+        void watch(NetworkHelper*);
+        void setLoading(bool);
+        void setMonthMode(bool);
+        bool getMonthMode();
+        int getHabitCount();
 
     private:
-        Adafruit_NeoPixel strip;
-        It* data;
+        const Layout* layout;  // of each habit segment
+        FrameEngine frames;
+        Habit* habits;
+        int habitCount;
         int pixelCount;
         bool awake;
         bool quietHours;
         bool freshDay;  // is true right after new day has started until quiet hour end. 
-        int loadingAnimationPixel;
+        bool monthMode;  // show the completion of the current month instead of the days
+
+        static const int WATCH_TIMEOUT;              // seconds the backend holds a watch request
+        static const unsigned long WATCH_RETRY_DELAY;  // after a failed watch request
+        bool watching;              // a watch request is parked on the backend connection
+        unsigned long watchStart;   // when the last watch request was sent
+        long watchVersion;          // backend version of the last sync
+        int syncCursor;             // habit to sync up first, where the last sync was cut off
 
         void initPixels();
-        int translatePixelLocation(int);
+        int translatePixelLocation(int, int);
+        void visualizeMonth(int);
         void setPixelPending(int);
         void setPixelUndone(int);
         void setPixelTodo(int);
         void setPixelDone(int, int);
-        void setPixelLoading(int);
         bool syncUp(NetworkHelper*);
         bool syncDown(NetworkHelper*);
+        bool startWatch(NetworkHelper*);
+        bool finishWatch(NetworkHelper*);
+        void stopWatch(NetworkHelper*);
 };
 
 #endif
\ No newline at end of file
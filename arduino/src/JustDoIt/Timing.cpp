@@ -2,81 +2,127 @@
 
 // Init static members
 
-Timezone Timing::tz;
-const char Timing::MYISO8601[] = "Y-m-d~TH:i:sP";
-
-int Timing::intervalMinutes = 15;
-void (*Timing::intervalCallback)() = NULL;
+const long Timing::DAY_ROLLOVER = 3 * SECS_PER_HOUR;
 
-void (*Timing::nextDayCallback)() = NULL;
+Timezone Timing::tz;
+Calendar Timing::calendar(&Timing::tz);
+Scheduler Timing::scheduler;
+Timing::DailyEvent* Timing::dailyEvents = NULL;
+time_t Timing::lastRtcUpdate = 0;
 
 int Timing::quietHourStart = 21;
 int Timing::quietHourEnd = 7;
 void (*Timing::quietHourCallback)(bool) = NULL;
+Scheduler::Handle Timing::quietHourTimer = Scheduler::INVALID_HANDLE;
 
-String Timing::getDate() {
-    return tz.dateTime(MYISO8601);
+long Timing::getDay() {
+    // local epoch day: days since 1970-01-01 in local time
+    return calendar.localDay(UTC.now());
 };
 
-bool Timing::syncTime() {
+void Timing::begin() {
     setDebug(INFO);
-    waitForSync(10);
-    tz.setLocation(F("de"));
-    return isSynced();
+
+    // A fixed rule instead of setLocation, which asks a timezone server before the time is usable
+    tz.setPosix(F("CET-1CEST,M3.5.0,M10.5.0/3"));
+    calendar.invalidate();
+
+    // After a reset the RTC still knows the time, no need to wait for the network
+    RtcClock::begin();
+    if (RtcClock::isValid()) {
+        UTC.setTime(RtcClock::now());
+        LOG_INFO("Time from RTC: %lu", RtcClock::now());
+    }
+};
+
+bool Timing::setTime(unsigned long utc) {
+    if (utc == 0) {
+        return false;
+    }
+
+    // ezTime keeps it up to date via NTP from now on
+    UTC.setTime(utc);
+    RtcClock::setTime(utc);
+    LOG_INFO("Time set: %lu", utc);
+    return true;
 };
 
 bool Timing::isSynced() {
-    return (timeStatus() == timeSet);
+    // RTC and wifi time are good enough, the NTP sync is allowed to lag behind
+    return (timeStatus() != timeNotSet);
 };
 
 void Timing::callEvents() {
-    // simply calls the eztime events trigger
+    // ezTime events keep the NTP sync alive, our own timers run on the scheduler
     events();
+
+    // keep the RTC in step with NTP, so it has the right time after the next reset
+    if (lastNtpUpdateTime() != lastRtcUpdate) {
+        lastRtcUpdate = lastNtpUpdateTime();
+        RtcClock::setTime(UTC.now());
+    }
+
+    scheduler.run();
+    releaseDailyEvents();
 }
 
-void Timing::onInterval(int minutes, void(*callback)()) {
-    intervalMinutes = minutes;
-    intervalCallback = callback;
-    deleteEvent(&Timing::onIntervalScheduler);
-    setEvent(&Timing::onIntervalScheduler, nextInterval(intervalMinutes));
-};
+Scheduler* Timing::getScheduler() {
+    return &scheduler;
+}
 
-time_t Timing::nextInterval(int minutes) {
-    tmElements_t tm;
-    breakTime(UTC.now(), tm);
-    tm.Minute = tm.Minute + minutes;
-    return makeTime(tm);
-};
+unsigned long Timing::millisUntil(time_t utc) {
+    time_t now = UTC.now();
+    if (utc <= now) {
+        return 0;
+    }
+    return (unsigned long)(utc - now) * 1000UL;
+}
 
-void Timing::onIntervalScheduler() {
-    intervalCallback();
-    setEvent(&Timing::onIntervalScheduler, nextInterval(intervalMinutes));
+Scheduler::Handle Timing::onInterval(int minutes, TimerCallback callback, void* context) {
+    return scheduler.setInterval(minutes * 60000UL, callback, context);
 };
 
-void Timing::onNextDay(void(*callback)()) {
-    nextDayCallback = callback;
-    deleteEvent(&Timing::onNextDayScheduler);
-    setEvent(&Timing::onNextDayScheduler, nextDay());
+Scheduler::Handle Timing::onNextDay(TimerCallback callback, void* context) {
+    DailyEvent* event = new DailyEvent();
+    event->callback = callback;
+    event->context = context;
+
+    // a daily period keeps the handle stable; every run reschedules to the exact local time
+    event->handle = scheduler.setInterval(SECS_PER_DAY * 1000UL, &Timing::onNextDayScheduler, event);
+    if (event->handle == Scheduler::INVALID_HANDLE) {
+        delete event;
+        return Scheduler::INVALID_HANDLE;
+    }
+    scheduler.reschedule(event->handle, millisUntil(nextDay()));
+
+    event->next = dailyEvents;
+    dailyEvents = event;
+    return event->handle;
 };
 
-time_t Timing::nextDay() {
+void Timing::releaseDailyEvents() {
+    // the handle is given out, so the timer may be cancelled on the scheduler directly
+    DailyEvent** link = &dailyEvents;
+    while (*link != NULL) {
+        DailyEvent* event = *link;
+        if (scheduler.isPending(event->handle)) {
+            link = &event->next;
+        } else {
+            *link = event->next;
+            delete event;
+        }
+    }
+}
 
-    tmElements_t tm;
-    breakTime(tz.now(), tm);
-
-    // Run at 03:00 on the next day
-    tm.Day = tm.Day + 1;
-    tm.Hour = 3;
-    tm.Minute = 0;
-    tm.Second = 0;
-  
-    time_t nextEventUTC = tz.tzTime(makeTime(tm));
-    return nextEventUTC;
+time_t Timing::nextDay() {
+    // Run at 03:00 on the next local day, early timers must not run the same day twice
+    return calendar.toUtc(getDay() + 1, DAY_ROLLOVER);
 };
 
-void Timing::onNextDayScheduler() {
-    nextDayCallback();
-    setEvent(&Timing::onNextDayScheduler, nextDay());
+void Timing::onNextDayScheduler(void* context) {
+    DailyEvent* event = (DailyEvent*) context;
+    scheduler.reschedule(event->handle, millisUntil(nextDay()));
+    event->callback(event->context);
 };
 
 void Timing::onQuietHour(int start, int end, void(*callback)(bool)) {
@@ -84,10 +130,10 @@ void Timing::onQuietHour(int start, int end, void(*callback)(bool)) {
     quietHourEnd = end;
     quietHourCallback = callback;
 
-    deleteEvent(&Timing::onQuietHourScheduler);
+    scheduler.cancel(quietHourTimer);
     // Calling the scheduler is always safe,
     // so we call it directly instead of scheduling an initial event for it.
-    onQuietHourScheduler();
+    onQuietHourScheduler(NULL);
 };
 
 void Timing::pauseQuietHour(int minutes) {
@@ -95,34 +141,26 @@ void Timing::pauseQuietHour(int minutes) {
     quietHourCallback(false);
 
     // Set an event in x minutes to reevaluate quiet hour status
-    tmElements_t tm;
-    breakTime(UTC.now(), tm);
-    tm.Minute = tm.Minute + minutes;
-    deleteEvent(&Timing::onQuietHourScheduler);
-    setEvent(&Timing::onQuietHourScheduler, makeTime(tm));
+    scheduler.cancel(quietHourTimer);
+    quietHourTimer = scheduler.setTimeout(minutes * 60000UL, &Timing::onQuietHourScheduler, NULL);
 }
 
-void Timing::onQuietHourScheduler() {
-    tmElements_t tm;
-    breakTime(tz.now(), tm);
+void Timing::onQuietHourScheduler(void*) {
+    time_t now = UTC.now();
+    long hour = calendar.secondOfDay(now) / SECS_PER_HOUR;
 
-    if (tm.Hour >= quietHourStart || tm.Hour < quietHourEnd) {
+    time_t nextEventUTC;
+    if (hour >= quietHourStart || hour < quietHourEnd) {
         // We're in quiet hours -> next event at quiet hour end.
-        tm.Day = tm.Day + 1;
-        tm.Hour = quietHourEnd;
-        tm.Minute = 0;
-        tm.Second = 0;
+        nextEventUTC = calendar.nextTime(now, quietHourEnd * SECS_PER_HOUR);
 
         quietHourCallback(true);
     } else {
         // We're outside of quiet hours -> next event at quiet hour start.
-        tm.Hour = quietHourStart;
-        tm.Minute = 0;
-        tm.Second = 0;
+        nextEventUTC = calendar.nextTime(now, quietHourStart * SECS_PER_HOUR);
 
         quietHourCallback(false);
     }
 
-    time_t nextEventUTC = tz.tzTime(makeTime(tm));
-    setEvent(onQuietHourScheduler, nextEventUTC);
-};
\ No newline at end of file
+    quietHourTimer = scheduler.setTimeout(millisUntil(nextEventUTC), &Timing::onQuietHourScheduler, NULL);
+};
@@ -1,40 +1,56 @@
 #ifndef _TIMING_H_
 #define _TIMING_H_
 
+#include "Scheduler.h"
+#include "RtcClock.h"
+#include "Calendar.h"
 #include <Arduino.h>
 #include <eztime.h>
+#include <Log.h>
 
 class Timing {
     public:
-        static bool syncTime();
+        static void begin();
+        static bool setTime(unsigned long utc);
         static bool isSynced();
         
         static void callEvents();
 
-        static String getDate();
+        static long getDay();
 
-        static void onInterval(int minutes, void(*function)());
-        static void onNextDay(void (*function)());
+        static Scheduler* getScheduler();
+        static Scheduler::Handle onInterval(int minutes, TimerCallback callback, void* context);
+        static Scheduler::Handle onNextDay(TimerCallback callback, void* context);
         static void onQuietHour(int start, int end, void(*function)(bool));
         static void pauseQuietHour(int minutes);
 
     private:
+        static const long DAY_ROLLOVER;  // local time of day the next day starts, in seconds
+
         static Timezone tz;
-        static const char MYISO8601[];
+        static Calendar calendar;
+        static Scheduler scheduler;
+        static time_t lastRtcUpdate;  // NTP update that was last written to the RTC
+
+        struct DailyEvent {
+            TimerCallback callback;
+            void* context;
+            Scheduler::Handle handle;
+            DailyEvent* next;
+        };
+        static DailyEvent* dailyEvents;  // freed once their timer is cancelled
 
-        static int intervalMinutes;
-        static void(*intervalCallback)();
-        static time_t nextInterval(int minutes);
-        static void onIntervalScheduler();
+        static unsigned long millisUntil(time_t utc);
 
-        static void(*nextDayCallback)();
         static time_t nextDay();
-        static void onNextDayScheduler();
+        static void onNextDayScheduler(void* event);
+        static void releaseDailyEvents();
 
         static int quietHourStart;
         static int quietHourEnd;
         static void(*quietHourCallback)(bool);
-        static void onQuietHourScheduler();
+        static Scheduler::Handle quietHourTimer;
+        static void onQuietHourScheduler(void*);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,14 +1,84 @@
 #!/usr/bin/env python
 
-from habit_model import HabitModel
+from habit_model import to_day, from_day, EmptyHabit, MIN_DAY, MAX_DAY
+from tenant_store import TenantStore
+import metrics
 
 import logging
-import json
-from jsonschema import validate, ValidationError, SchemaError
-from flask import Flask, request, jsonify
+import logging.handlers
+import msgpack
+import orjson
+import queue
+import re
+from jsonschema import Draft7Validator, ValidationError
+from flask import Flask, request, abort, Response, g
 
 app = Flask(__name__)
-meditation_habit = None
+
+data_dir = '/data'
+habit_name_pattern = re.compile(r'^[a-z0-9_-]{1,32}$')
+
+# Every client certificate is a tenant with its own habits,
+# the TLS terminator forwards the certificate subject of the verified client
+TENANT_HEADER = 'X-SSL-Client-S-DN'
+MAX_TENANTS = 1000  # idle tenants kept in memory
+tenant_store = TenantStore(app.logger, data_dir, MAX_TENANTS)
+empty_habit = EmptyHabit()  # answers read-only queries for habits that were never written
+
+MSGPACK_MIMETYPE = 'application/msgpack'
+NDJSON_MIMETYPE = 'application/x-ndjson'
+
+# Bulk import: days are added in batches, one file append per batch
+IMPORT_BATCH = 1000
+
+# Long poll: every change of any habit of a tenant gets the tenant's next version number
+WATCH_TIMEOUT = 50  # seconds, stay below the read timeout of the reverse proxy
+
+# Days per window, history or stats range: ten years, far beyond the largest layout
+MAX_WINDOW_DAYS = 3660
+
+count_schema = {"type": "integer", "minimum": 1, "maximum": MAX_WINDOW_DAYS}
+
+day_schema = {"type": "integer", "minimum": MIN_DAY, "maximum": MAX_DAY}
+
+history_schema = {
+    "type": "object",
+    "properties": {
+        "startDate": {"type": "string"},
+        "count": {"type": "integer", "minimum": 0, "maximum": MAX_WINDOW_DAYS}
+    },
+    "required": ["startDate", "count"]
+}
+
+streak_schema = {
+    "type": "object",
+    "properties": {
+        "startDate": {"type": "string"},
+        "day": day_schema
+    },
+    "oneOf": [{"required": ["startDate"]}, {"required": ["day"]}]
+}
+
+range_list_schema = {
+    "type": "array",
+    "maxItems": 16,
+    "items": {
+        "type": "object",
+        "properties": {
+            "from": day_schema,
+            "to": day_schema
+        },
+        "required": ["from", "to"]
+    }
+}
+
+stats_schema = {
+    "type": "object",
+    "properties": {
+        "ranges": range_list_schema
+    },
+    "required": ["ranges"]
+}
 
 date_list_schema = {
     "type": "object",
@@ -23,136 +93,430 @@ date_list_schema = {
         "dates": {
             "type": "array",
             "items": {"$ref": "#/definitions/DateEntry"}
+        },
+        "days": {
+            "type": "array",
+            "items": day_schema
         }
     },
     "additionalProperties": False,
-    "required": ["dates"]
+    "oneOf": [{"required": ["dates"]}, {"required": ["days"]}]
 }
 
-
-@app.route('/habit/meditation', methods=['GET'])
-def get_dates():
-    """Get interpolated list of dates from last x days."""
-    schema = {
-        "type": "object",
-        "properties": {
-            "startDate": {"type": "string"},
-            "count": {"type": "number"}
+sync_schema = {
+    "type": "object",
+    "properties": {
+        "startDate": {"type": "string"},
+        "day": day_schema,
+        "count": count_schema,
+        "habits": {
+            "type": "array",
+            "items": {"type": "string", "pattern": habit_name_pattern.pattern}
         },
-        "required": ["startDate", "count"]
+        "ranges": range_list_schema
+    },
+    "required": ["count", "habits"],
+    "oneOf": [{"required": ["startDate"]}, {"required": ["day"]}]
+}
+
+
+watch_schema = {
+    "type": "object",
+    "properties": {
+        "version": {"type": "integer"},
+        "timeout": {"type": "number", "minimum": 0},
+        "habits": {
+            "type": "array",
+            "items": {"type": "string", "pattern": habit_name_pattern.pattern}
+        }
+    },
+    "required": ["version", "habits"]
+}
+
+
+def compile_validator(schema):
+    """Check the schema once at startup and get a validator that is reused by every request."""
+    Draft7Validator.check_schema(schema)
+    return Draft7Validator(schema)
+
+
+history_validator = compile_validator(history_schema)
+streak_validator = compile_validator(streak_schema)
+stats_validator = compile_validator(stats_schema)
+date_list_validator = compile_validator(date_list_schema)
+sync_validator = compile_validator(sync_schema)
+watch_validator = compile_validator(watch_schema)
+
+
+def parse_body():
+    """Parse the request body as MessagePack or JSON, depending on its content type."""
+    with metrics.stage('parse'):
+        app.logger.debug('Request body: %s', request.data)
+        if request.mimetype == MSGPACK_MIMETYPE:
+            return msgpack.unpackb(request.data)
+        return orjson.loads(request.data)
+
+
+def validate_body(body, validator):
+    """Validate the request body with a precompiled validator."""
+    with metrics.stage('validate'):
+        validator.validate(body)
+
+
+def wants_msgpack():
+    """Check if the client explicitly prefers MessagePack over JSON. Wildcards like */* get JSON."""
+    msgpack_quality = max([quality for value, quality in request.accept_mimetypes if value == MSGPACK_MIMETYPE], default=0)
+    return msgpack_quality > request.accept_mimetypes['application/json']
+
+
+def respond(body, status):
+    """Serialize the response as MessagePack if the client asks for it, JSON otherwise."""
+    with metrics.stage('serialize'):
+        if wants_msgpack():
+            return Response(msgpack.packb(body), status=status, mimetype=MSGPACK_MIMETYPE)
+        return Response(orjson.dumps(body), status=status, mimetype='application/json')
+
+
+@app.before_request
+def start_metrics():
+    metrics.start_request()
+
+
+@app.after_request
+def finish_metrics(response):
+    metrics.finish_request(request.url_rule.rule if request.url_rule else 'unknown', response.status_code)
+    return response
+
+
+@app.before_request
+def acquire_tenant():
+    # requests without a client certificate share the default tenant
+    g.tenant = tenant_store.acquire(request.headers.get(TENANT_HEADER))
 
-    }
 
-    app.logger.info('Get request body: %s', request.data)
+@app.teardown_request
+def release_tenant(exception):
+    if 'tenant' in g:
+        tenant_store.release(g.tenant)
 
-    history_json = json.loads(request.data)
+
+def get_habit(habit_name):
+    """Get the habit store for habit_name of the requesting tenant, create it on first access."""
+    if not habit_name_pattern.match(habit_name):
+        return None
+    return g.tenant.get_habit(habit_name)
+
+
+def find_habit(habit_name):
+    """Get the habit store for habit_name of the requesting tenant without creating it, an empty stand-in if it doesn't exist."""
+    habit = g.tenant.find_habit(habit_name) if habit_name_pattern.match(habit_name) else None
+    return habit or empty_habit
+
+
+def mark_changed(habit):
+    """Give the habit the next version of its tenant and wake up waiting watch requests, return the version of the change."""
+    return g.tenant.mark_changed(habit)
+
+
+def require_habit(habit_name):
+    """Get the habit store for habit_name or abort with 404 on invalid names."""
+    habit = get_habit(habit_name)
+    if habit is None:
+        abort(404)
+    return habit
+
+
+@app.route('/habit/<habit_name>', methods=['GET'])
+def get_dates(habit_name):
+    """Get interpolated list of dates from last x days."""
+    habit = require_habit(habit_name)
+
+    history_json = parse_body()
     if history_json is not None:
         try:
-            validate(history_json, schema)
-        except SchemaError as e:
-            app.logger.error('Schema definition invalid.')
-            return jsonify({'history': []}), 500
+            validate_body(history_json, history_validator)
         except ValidationError as e:
-            app.logger.warning(e)
-            return jsonify({'history': []}), 400
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'history': []}, 400)
         else:
-            app.logger.info('Retreiving history for last %s days from %s', history_json['count'], history_json["startDate"])
-            history = meditation_habit.get_history(history_json["startDate"], history_json["count"])
-            return jsonify(history), 200
+            app.logger.debug('Retreiving history for last %s days from %s', history_json['count'], history_json["startDate"])
+            with metrics.stage('model'):
+                history = habit.get_history(history_json["startDate"], history_json["count"])
+            return respond(history, 200)
 
-    return jsonify({'history': []}), 500
+    return respond({'history': []}, 500)
 
 
-@app.route('/habit/meditation', methods=['POST'])
-def add_dates():
+@app.route('/habit/<habit_name>', methods=['POST'])
+def add_dates(habit_name):
     """Submit a list of dates when the habit was done."""
-    dates = json.loads(request.data)
+    habit = require_habit(habit_name)
+
+    dates = parse_body()
     if dates is not None:
-        app.logger.info('request json: %s', dates)
         try:
-            validate(dates, date_list_schema)
-        except SchemaError as e:
-            app.logger.error('Schema definition invalid.')
-            return jsonify({'added': 0}), 500
+            validate_body(dates, date_list_validator)
         except ValidationError as e:
-            app.logger.warning(e)
-            jsonify({'added': 0}), 400
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'added': 0}, 400)
         else:
-            app.logger.info('Adding list of dates: %s.', dates['dates'][0])
             try:
-                added = meditation_habit.add_dates(dates['dates'])
+                with metrics.stage('model'):
+                    if 'days' in dates:
+                        added = habit.add_days(dates['days'])
+                    else:
+                        added = habit.add_dates(dates['dates'])
             except Exception as e:
                 app.logger.warning(e)
-                return jsonify({'added': 0}), 500
+                return respond({'added': 0}, 500)
             else:
                 if added > 0:
-                    return jsonify({'added': added}), 201
+                    # the device skips its own change in the watch when this is the next version it expects
+                    return respond({'added': added, 'version': mark_changed(habit)}, 201)
                 else:
-                    return jsonify({'added': added}), 200
+                    return respond({'added': added}, 200)
 
-    return jsonify({'added': 0}), 500
+    return respond({'added': 0}, 500)
 
 
 
-@app.route('/habit/meditation', methods=['DELETE'])
-def delete_dates():
+@app.route('/habit/<habit_name>', methods=['DELETE'])
+def delete_dates(habit_name):
     """Delete a list of dates when a habit was not done."""
-    dates = json.loads(request.data)
+    habit = require_habit(habit_name)
+
+    dates = parse_body()
     if dates is not None:
         try:
-            validate(dates, date_list_schema)
-        except SchemaError as e:
-            app.logger.error('Schema definition invalid.')
-            return jsonify({'deleted': 0}), 500
+            validate_body(dates, date_list_validator)
         except ValidationError as e:
-            app.logger.warning(e)
-            return jsonify({'deleted': 0}), 400
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'deleted': 0}, 400)
         else:
-            app.logger.info('Deleting list of dates: %s.', dates['dates'][0])
             try:
-                deleted = meditation_habit.delete_dates(dates['dates'])
+                with metrics.stage('model'):
+                    if 'days' in dates:
+                        deleted = habit.delete_days(dates['days'])
+                    else:
+                        deleted = habit.delete_dates(dates['dates'])
             except Exception:
-                return jsonify({'deleted': 0}), 500
+                return respond({'deleted': 0}, 500)
             else:
-                return jsonify({'deleted': deleted}), 200
+                if deleted > 0:
+                    return respond({'deleted': deleted, 'version': mark_changed(habit)}, 200)
+                return respond({'deleted': deleted}, 200)
 
-    return jsonify({'deleted': 0}), 500
+    return respond({'deleted': 0}, 500)
 
-@app.route('/habit/meditation/streak', methods=['GET'])
-def get_streak():
+@app.route('/habit/<habit_name>/streak', methods=['GET'])
+def get_streak(habit_name):
     """Get streak for specific date (consecutive days where habit was done)"""
-    schema = {
-        "type": "object",
-        "properties": {
-            "startDate": {"type": "string"}
-        },
-        "required": ["startDate"]
+    habit = require_habit(habit_name)
 
-    }
+    req_json = parse_body()
+    if req_json is not None:
+        try:
+            validate_body(req_json, streak_validator)
+        except ValidationError as e:
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'streak': -1}, 400)
+        else:
+            with metrics.stage('model'):
+                if 'day' in req_json:
+                    streak = {'streak': habit.get_streak_day(req_json['day'])}
+                else:
+                    streak = habit.get_streak(req_json["startDate"])
+            return respond(streak, 200)
+
+    return respond({'streak': -1}, 500)
+
+
+def check_ranges(ranges):
+    """Raise ValidationError for ranges longer than MAX_WINDOW_DAYS, which the schema can't express."""
+    for r in ranges:
+        if r['to'] - r['from'] >= MAX_WINDOW_DAYS:
+            raise ValidationError('Range %s to %s is longer than %d days' % (r['from'], r['to'], MAX_WINDOW_DAYS))
+
+
+@app.route('/habit/<habit_name>/stats', methods=['GET'])
+def get_stats(habit_name):
+    """Get done days, number of days and longest streak for each range of epoch days, and the longest streak ever."""
+    habit = require_habit(habit_name)
+
+    req_json = parse_body()
+    if req_json is not None:
+        try:
+            validate_body(req_json, stats_validator)
+            check_ranges(req_json['ranges'])
+        except ValidationError as e:
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'stats': []}, 400)
+        else:
+            with metrics.stage('model'):
+                stats = [habit.get_stats(r['from'], r['to']) for r in req_json['ranges']]
+                longest = habit.get_index().longest_ever()
+            return respond({'stats': stats, 'longest': longest}, 200)
+
+    return respond({'stats': []}, 500)
 
-    app.logger.info('Get request body: %s', request.data)
 
-    req_json = json.loads(request.data)
+@app.route('/habit/<habit_name>/export', methods=['GET'])
+def export_days(habit_name):
+    """Stream all days of a habit as NDJSON, one record per line: {"day": 18581, "date": "2020-11-15"}"""
+    habit = require_habit(habit_name)
+
+    with metrics.stage('model'):
+        days = habit.export_days()
+
+    def generate():
+        for day in days:
+            yield orjson.dumps({'day': day, 'date': from_day(day).isoformat()}) + b'\n'
+
+    return Response(generate(), mimetype=NDJSON_MIMETYPE)
+
+
+def parse_record(line):
+    """Get the epoch day of an NDJSON import record, either {"day": 18581} or {"date": "2020-11-15T10:14:43+01:00"}."""
+    record = orjson.loads(line)
+    if isinstance(record, dict):
+        day = record.get('day')
+        # bool is an int too
+        if isinstance(day, int) and not isinstance(day, bool):
+            if not MIN_DAY <= day <= MAX_DAY:
+                raise ValueError('Day %d is not a valid date' % day)
+            return day
+        if isinstance(record.get('date'), str):
+            return to_day(record['date'])
+    raise ValueError('Record needs an integer day or a date string')
+
+
+@app.route('/habit/<habit_name>/import', methods=['POST'])
+def import_days(habit_name):
+    """Add the days of an NDJSON stream (the export format), reading and storing it in batches.
+
+    Batches before an invalid record stay stored, the response tells how many days were added.
+    """
+    habit = require_habit(habit_name)
+
+    added = 0
+    batch = []
+    try:
+        for number, line in enumerate(request.stream, 1):
+            if not line.strip():
+                continue
+            try:
+                batch.append(parse_record(line))
+            except ValueError as e:
+                app.logger.warning('Invalid import record in line %d: %s', number, e)
+                return respond({'added': added, 'error': 'line %d: %s' % (number, e)}, 400)
+
+            if len(batch) >= IMPORT_BATCH:
+                with metrics.stage('model'):
+                    added += habit.add_days(batch)
+                batch = []
+
+        if batch:
+            with metrics.stage('model'):
+                added += habit.add_days(batch)
+    finally:
+        if added > 0:
+            mark_changed(habit)
+
+    return respond({'added': added}, 201 if added > 0 else 200)
+
+
+@app.route('/habits/sync', methods=['POST'])
+def sync_habits():
+    """Get window state and carried streak of several habits in one response."""
+    req_json = parse_body()
     if req_json is not None:
         try:
-            validate(req_json, schema)
-        except SchemaError as e:
-            app.logger.error('Schema definition invalid.')
-            return jsonify({'streak': -1}), 500
+            validate_body(req_json, sync_validator)
+            check_ranges(req_json.get('ranges', []))
         except ValidationError as e:
-            app.logger.warning(e)
-            return jsonify({'streak': -1}), 400
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'habits': []}, 400)
         else:
-            app.logger.info('Retreiving streak information from %s', req_json["startDate"])
-            streak = meditation_habit.get_streak(req_json["startDate"])
-            return jsonify(streak), 200
+            if 'day' in req_json:
+                start_day = req_json['day']
+            else:
+                start_day = to_day(req_json['startDate'])
+
+            # the version before reading, so a change while reading wakes the next watch
+            result = {'habits': [], 'version': g.tenant.change_version}
+            with metrics.stage('model'):
+                for habit_name in req_json['habits']:
+                    habit = find_habit(habit_name)
+                    window = habit.get_window(start_day, req_json['count'])
+                    window['name'] = habit_name
+                    if 'ranges' in req_json:
+                        window['stats'] = [habit.get_stats(r['from'], r['to']) for r in req_json['ranges']]
+                    result['habits'].append(window)
+            return respond(result, 200)
+
+    return respond({'habits': []}, 500)
+
+
+@app.route('/habits/watch', methods=['POST'])
+def watch_habits():
+    """Long poll: return as soon as one of the habits changed after version, or when the timeout passed."""
+    req_json = parse_body()
+    if req_json is not None:
+        try:
+            validate_body(req_json, watch_validator)
+        except ValidationError as e:
+            app.logger.warning('Invalid request: %s', e.message)
+            return respond({'changed': []}, 400)
+        else:
+            since = req_json['version']
+            timeout = min(req_json.get('timeout', WATCH_TIMEOUT), WATCH_TIMEOUT)
+            tenant = g.tenant
+            watched = {name: find_habit(name) for name in req_json['habits']}
+
+            def changed_habits():
+                # a version from before a backend restart or eviction: everything may have changed
+                if not tenant.first_version <= since <= tenant.change_version:
+                    return list(watched)
+                # a habit written for the first time while waiting exists now
+                for name, habit in watched.items():
+                    if habit is empty_habit:
+                        watched[name] = find_habit(name)
+                return [name for name, habit in watched.items() if habit.changed_version > since]
+
+            with tenant.changes:
+                with metrics.stage('wait'):
+                    tenant.changes.wait_for(changed_habits, timeout)
+                result = {'version': tenant.change_version, 'changed': changed_habits()}
+            return respond(result, 200)
+
+    return respond({'changed': []}, 500)
+
+
+@app.route('/metrics', methods=['GET'])
+def get_metrics():
+    """Request latencies per endpoint and stage, file access counters (Prometheus text format)."""
+    return Response(metrics.render(), mimetype='text/plain; version=0.0.4')
+
+
+def init_logging(level):
+    """Log through a queue, so formatting and writing happen in a background thread, not in requests."""
+    log_queue = queue.SimpleQueue()
+    handler = logging.StreamHandler()
+    handler.setFormatter(logging.Formatter('[%(asctime)s] %(levelname)s in %(module)s: %(message)s'))
+    listener = logging.handlers.QueueListener(log_queue, handler, respect_handler_level=True)
+    listener.start()
+
+    # the queue only carries the message, the listener's handler does the formatting
+    queue_handler = logging.handlers.QueueHandler(log_queue)
+    queue_handler.setFormatter(logging.Formatter('%(message)s'))
+    logging.basicConfig(level=level, handlers=[queue_handler])
+    # Flask's default handler would write in the request thread again
+    app.logger.handlers.clear()
+    return listener
 
-    return jsonify({'streak': -1}), 500
 
 if __name__ == '__main__':
-    logging.basicConfig(level=logging.DEBUG)
+    init_logging(logging.INFO)
     app.logger.info('Starting Webserver')
 
-    meditation_habit = HabitModel(app.logger, '/data/meditation.csv')
-
     app.run(host='0.0.0.0', threaded=True, debug=False)
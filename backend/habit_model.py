@@ -1,4 +1,13 @@
-from datetime import timedelta, datetime
+from datetime import timedelta, datetime, date
+from bisect import bisect_left, bisect_right
+import threading
+
+import metrics
+
+EPOCH_ORDINAL = date(1970, 1, 1).toordinal()
+# epoch days that are valid dates, from_day fails outside of them
+MIN_DAY = date.min.toordinal() - EPOCH_ORDINAL
+MAX_DAY = date.max.toordinal() - EPOCH_ORDINAL
 
 
 def daterange(start_date, count):
@@ -6,13 +15,95 @@ def daterange(start_date, count):
         yield start_date - timedelta(days)
 
 
+def to_day(iso_date):
+    """Convert ISO8601 date string to local epoch day (days since 1970-01-01 in the date's timezone)."""
+    return datetime.fromisoformat(iso_date).date().toordinal() - EPOCH_ORDINAL
+
+
+def from_day(day):
+    """Convert local epoch day to date."""
+    return date.fromordinal(day + EPOCH_ORDINAL)
+
+
+class DayIndex:
+    """Range queries over a set of epoch days in O(log n).
+
+    The position of a day in the sorted list is the number of days before it (the prefix sum),
+    so counting the days in a range takes two binary searches. Runs of consecutive days are kept as
+    first and last day, with a sparse table of their lengths for the longest run within a range.
+    """
+
+    def __init__(self, days):
+        """Build the index from an unsorted collection of days."""
+        self.days = sorted(days)
+        self.run_firsts = []
+        self.run_lasts = []
+        for day in self.days:
+            if self.run_lasts and self.run_lasts[-1] == day - 1:
+                self.run_lasts[-1] = day
+            else:
+                self.run_firsts.append(day)
+                self.run_lasts.append(day)
+
+        # longest_runs[k][i] is the longest of the runs i to i + 2^k - 1
+        self.longest_runs = [[last - first + 1 for first, last in zip(self.run_firsts, self.run_lasts)]]
+        width = 2
+        while width <= len(self.run_firsts):
+            shorter = self.longest_runs[-1]
+            half = width // 2
+            self.longest_runs.append([max(shorter[i], shorter[i + half]) for i in range(len(shorter) - half)])
+            width *= 2
+
+    def count(self, first, last):
+        """Get the number of days from first to last (inclusive)."""
+        if last < first:
+            return 0
+        return bisect_right(self.days, last) - bisect_left(self.days, first)
+
+    def longest_of_runs(self, i, j):
+        """Get the longest of the runs i to j (inclusive)."""
+        k = (j - i + 1).bit_length() - 1
+        return max(self.longest_runs[k][i], self.longest_runs[k][j - (1 << k) + 1])
+
+    def longest(self, first, last):
+        """Get the longest run of consecutive days from first to last, runs crossing the bounds count with their part inside."""
+        if last < first:
+            return 0
+        i = bisect_left(self.run_lasts, first)
+        j = bisect_right(self.run_firsts, last) - 1
+        if i > j:
+            return 0
+        if i == j:
+            return min(self.run_lasts[i], last) - max(self.run_firsts[i], first) + 1
+
+        longest = max(self.run_lasts[i] - max(self.run_firsts[i], first) + 1,
+                      min(self.run_lasts[j], last) - self.run_firsts[j] + 1)
+        if j - i > 1:
+            longest = max(longest, self.longest_of_runs(i + 1, j - 1))
+        return longest
+
+    def longest_ever(self):
+        """Get the longest run of consecutive days."""
+        if not self.run_firsts:
+            return 0
+        return self.longest_of_runs(0, len(self.run_firsts) - 1)
+
+
 class HabitModel:
-    """A model class to store and retrieve habit data from csv."""
+    """A model class to store and retrieve habit data from csv.
+
+    The csv file holds one ISO8601 date per line. It is read once into a set of epoch days,
+    all queries are answered from that set.
+    """
 
     def __init__(self, logger, dates_filename):
         """Init habit model."""
         self.logger = logger
         self.dates_filename = dates_filename
+        self.days = set()
+        self.index = None  # DayIndex of days, built on the first stats query after a change
+        self.lock = threading.Lock()
+        self.changed_version = 0  # set by the api controller on every change
 
         # Create file if not exists
         try:
@@ -21,6 +112,17 @@ class HabitModel:
         except FileExistsError:
             self.logger.info('Dates file exists: %s', self.dates_filename)
 
+        metrics.count('habit_file_reads_total')
+        with open(self.dates_filename, 'r') as dates_file:
+            for line in dates_file:
+                metrics.count('habit_file_bytes_read_total', len(line))
+                line = line.strip()
+                try:
+                    self.days.add(to_day(line))
+                except ValueError:
+                    if line:
+                        self.logger.warning('Skipping invalid date in %s: %s', self.dates_filename, line)
+
     def get_history(self, start_date, count):
         """Get single date by counting back from start_date"""
         history = {"history": []}
@@ -29,13 +131,12 @@ class HabitModel:
         count_date = start_date - timedelta(count)
 
         done = 0
-        with open(self.dates_filename, 'r') as dates_file:
-            if count_date.strftime("%Y-%m-%d") in dates_file.read():
-                done = 1
-    
+        if to_day(count_date.isoformat()) in self.days:
+            done = 1
+
         date = {"date": count_date.isoformat(), "done": done}
         history["history"].append(date)
-        
+
         return history
 
     def get_history_padded(self, start_date, count):
@@ -43,86 +144,113 @@ class HabitModel:
         history = {"history": []}
 
         start_date = datetime.fromisoformat(start_date)
+        start_day = to_day(start_date.isoformat())
 
-        with open(self.dates_filename, 'r') as dates_file:
-            dates_file_read = dates_file.read()
-
-        index = 0
-        for date in daterange(start_date, count):
-            # self.logger.info('Date: %s', date.strftime("%Y-%m-%d"))
-            # self.logger.info("Date iso! %s", date.isoformat())
-
+        for index, date in enumerate(daterange(start_date, count)):
             done = 0
 
-            if date.strftime("%Y-%m-%d") in dates_file_read:
+            if start_day - index in self.days:
                 done = 1
 
             item = {"date": date.isoformat(), "done": done}
             history["history"].append(item)
 
-            index += 1
-
         return history
 
-    def get_streak(self, start_date):
-        """Get number of consecutive dates found in the data store starting at start_date"""
+    def get_window(self, start_day, count):
+        """Get done state of the last x days and the streak carried into the window from before it.
+
+        The device computes streaks inside the window itself, carry is the streak ending on the day
+        just before the oldest day of the window. The done state is a bitmap packed into 32 bit words: bit i of word i // 32 is start_day - i.
+        """
+        bits = [0] * ((count + 31) // 32)
+        for index in range(count):
+            if start_day - index in self.days:
+                bits[index // 32] |= 1 << (index % 32)
+
+        return {"bits": bits, "carry": self.get_streak_day(start_day - count)}
+
+    def get_streak_day(self, start_day):
+        """Get number of consecutive days found in the data store counting back from start_day"""
         streak = 0
+        while start_day - streak in self.days:
+            streak += 1
+        return streak
 
-        start_date = datetime.fromisoformat(start_date)
+    def get_streak(self, start_date):
+        """Get number of consecutive dates found in the data store starting at start_date"""
+        return {"streak": self.get_streak_day(to_day(start_date))}
 
-        with open(self.dates_filename, 'r') as dates_file:
-            dates_file_read = dates_file.read()
+    def get_index(self):
+        """Get the range query index of the current days."""
+        with self.lock:
+            if self.index is None:
+                self.index = DayIndex(self.days)
+            return self.index
 
-        # for last ten years...
-        for date in daterange(start_date, 36500):
-            if not date.strftime("%Y-%m-%d") in dates_file_read:
-                return {"streak": streak}
-            else:
-                streak += 1
-        
-        return {"streak": streak}
+    def get_stats(self, first, last):
+        """Get done days, number of days and the longest streak from first to last (epoch days, inclusive)."""
+        index = self.get_index()
+        return {"done": index.count(first, last), "days": max(last - first + 1, 0), "longest": index.longest(first, last)}
 
-    def add_dates(self, dates):
-        """Store list of dates to csv file."""
+    def add_days(self, days):
+        """Store list of epoch days to csv file."""
         add_count = 0
-        with open(self.dates_filename, 'a+') as dates_file:
-            for date in dates:
-                # validate time format: throws exception to api_controller
-                datetime.fromisoformat(date["date"])
-                self.logger.info("Adding date: %s", date)
-
-                # if date (without time) doesn't exist in file, insert full date at end of file
-                dates_file.seek(0)  # seek to file start
-                if date["date"].split('T')[0] not in dates_file.read():
-                    dates_file.seek(0, 2)  # seek to file end
-                    dates_file.write(date["date"] + "\n")
+        written = 0
+        with self.lock, open(self.dates_filename, 'a') as dates_file:
+            for day in days:
+                if day not in self.days:
+                    self.logger.debug("Adding day: %s", day)
+                    written += dates_file.write(from_day(day).isoformat() + "\n")
+                    self.days.add(day)
                     add_count += 1
+            if add_count > 0:
+                self.index = None
+        metrics.count('habit_file_writes_total')
+        metrics.count('habit_file_bytes_written_total', written)
         return add_count
 
+    def add_dates(self, dates):
+        """Store list of dates to csv file."""
+        # validate time format: throws exception to api_controller
+        return self.add_days([to_day(date["date"]) for date in dates])
+
+    def export_days(self):
+        """Get all stored epoch days in ascending order, from a snapshot taken under the lock."""
+        with self.lock:
+            return sorted(self.days)
+
+    def delete_days(self, days):
+        """Delete list of epoch days from csv file."""
+        with self.lock:
+            deleted = self.days.intersection(days)
+            if not deleted:
+                return 0
+
+            self.days.difference_update(deleted)
+            self.index = None
+
+            # rewrite the file from the remaining days
+            written = 0
+            with open(self.dates_filename, 'w') as dates_file:
+                for day in sorted(self.days):
+                    written += dates_file.write(from_day(day).isoformat() + "\n")
+            metrics.count('habit_file_writes_total')
+            metrics.count('habit_file_bytes_written_total', written)
+
+        return len(deleted)
+
     def delete_dates(self, dates):
         """Delete list of dates from csv file."""
-        delete_count = 0
-        with open(self.dates_filename, 'r+') as dates_file:
-            # cut file contents to memory
-            dates_file.seek(0)
-            dates_file_lines = dates_file.readlines()
-
-            dates_file.seek(0)
-            dates_file.truncate()
-
-            # write all lines except for to be deleted back to file
-            for line in dates_file_lines:
-                date_found = False
-
-                for date in dates:
-                    self.logger.info('searching for date %s', date["date"])
-                    if date["date"].split('T')[0] in line:
-                        self.logger.info('found date in line: \n%s', line)
-                        date_found = True
-                        delete_count += 1
-
-                if not date_found:
-                    self.logger.info('writing line: \n%s', line)
-                    dates_file.write(line)
-
-        return delete_count
+        return self.delete_days([to_day(date["date"]) for date in dates])
+
+
+class EmptyHabit(HabitModel):
+    """Read-only stand-in for a habit that has never been written, so queries for unknown names don't create files."""
+
+    def __init__(self):
+        """Init empty habit without a csv file."""
+        self.days = frozenset()
+        self.index = None
+        self.lock = threading.Lock()
+        self.changed_version = 0
@@ -0,0 +1,113 @@
+from collections import OrderedDict
+import hashlib
+import itertools
+import os
+import random
+import threading
+
+from habit_model import HabitModel
+import metrics
+
+
+class Tenant:
+    """The habits of one client. Every tenant has its own lock and change version, so tenants never wait for each other."""
+
+    def __init__(self, logger, tenant_dir):
+        """Init tenant, habit stores are loaded on first access."""
+        self.logger = logger
+        self.tenant_dir = tenant_dir
+        self.habits = {}
+        self.lock = threading.Lock()
+        self.active = 0  # requests using the tenant, guarded by the store lock
+
+        # Long poll: every change of any habit of this tenant gets the next version number.
+        # Every load starts at a random version, so a version from before a restart or eviction
+        # is almost certainly outside of first_version..change_version. It stays below 2^31 for the device.
+        self.changes = threading.Condition()
+        self.first_version = random.randrange(1, 2 ** 30)
+        self.change_version = self.first_version
+
+    def get_habit(self, habit_name):
+        """Get the habit store for habit_name, create it on first access."""
+        with self.lock:
+            habit = self.habits.get(habit_name)
+            if habit is None:
+                os.makedirs(self.tenant_dir, exist_ok=True)
+                habit = HabitModel(self.logger, self.habit_filename(habit_name))
+                self.habits[habit_name] = habit
+            return habit
+
+    def find_habit(self, habit_name):
+        """Get the habit store for habit_name without creating it, None if the habit has never been written."""
+        with self.lock:
+            habit = self.habits.get(habit_name)
+        if habit is None and os.path.exists(self.habit_filename(habit_name)):
+            habit = self.get_habit(habit_name)
+        return habit
+
+    def habit_filename(self, habit_name):
+        """Get the csv file of a habit."""
+        return os.path.join(self.tenant_dir, habit_name + '.csv')
+
+    def mark_changed(self, habit):
+        """Give the habit the next version and wake up waiting watch requests, return the version of the change."""
+        with self.changes:
+            self.change_version += 1
+            habit.changed_version = self.change_version
+            self.changes.notify_all()
+            return self.change_version
+
+
+class TenantStore:
+    """Tenants keyed by client identity, loaded lazily and evicted least recently used.
+
+    Tenant data lives in data_dir/tenants/<shard>/<id>/, where id is a hash of the identity and shard its first two
+    characters, so no directory grows beyond a few hundred entries. Habit stores write through to disk,
+    evicting a tenant only drops its memory. Tenants that are in use by a request are never evicted.
+    Requests without an identity use the default tenant, which keeps its files directly in data_dir.
+    """
+
+    def __init__(self, logger, data_dir, max_tenants):
+        """Init tenant store, keeping at most max_tenants idle tenants in memory."""
+        self.logger = logger
+        self.data_dir = data_dir
+        self.max_tenants = max_tenants
+        self.tenants = OrderedDict()
+        self.lock = threading.Lock()
+
+    def tenant_dir(self, identity):
+        """Get the directory of a tenant."""
+        if identity is None:
+            return self.data_dir
+        tenant_id = hashlib.sha256(identity.encode('utf-8')).hexdigest()[:32]
+        return os.path.join(self.data_dir, 'tenants', tenant_id[:2], tenant_id)
+
+    def acquire(self, identity):
+        """Get the tenant for identity and mark it in use until release."""
+        with self.lock:
+            tenant = self.tenants.get(identity)
+            if tenant is None:
+                # only the bookkeeping happens under the lock, habit files are read on first access
+                tenant = Tenant(self.logger, self.tenant_dir(identity))
+                self.tenants[identity] = tenant
+                metrics.count('tenant_loads_total')
+            else:
+                self.tenants.move_to_end(identity)
+            tenant.active += 1
+            self.evict()
+            return tenant
+
+    def release(self, tenant):
+        """Mark the tenant as no longer used by the request."""
+        with self.lock:
+            tenant.active -= 1
+
+    def evict(self):
+        """Drop least recently used idle tenants above the budget. Called with the lock held."""
+        excess = len(self.tenants) - self.max_tenants
+        if excess <= 0:
+            return
+        idle = (identity for identity, tenant in self.tenants.items() if tenant.active == 0)
+        for identity in list(itertools.islice(idle, excess)):
+            del self.tenants[identity]
+            metrics.count('tenant_evictions_total')
@@ -0,0 +1,205 @@
+#!/usr/bin/env python
+"""Replay device traffic captured by NetworkHelper against a local backend.
+
+With capture mode on, the device writes one "#JDT <base64>" line per request/response exchange
+to its serial port. Save the serial output to a file, then replay it:
+
+    python3 replay_trace.py capture.log --backend http://localhost:5555
+
+Without --backend only the recorded traffic is summarized.
+"""
+
+import argparse
+import base64
+import http.client
+import socket
+import statistics
+import struct
+import sys
+import time
+import urllib.parse
+
+TRACE_MARKER = '#JDT '
+TRACE_VERSION = 1
+METHODS = ['GET', 'POST', 'DELETE', 'OTHER']
+MSGPACK_MIMETYPE = 'application/msgpack'
+
+# version, method, flags, error, start, latency, status, request bytes, response bytes
+HEADER = struct.Struct('<BBBBIHHHH')
+
+
+def parse_record(data):
+    """Decode one binary trace record, see NetworkHelper::captureExchange."""
+    (version, method, flags, error, start, latency, status,
+     request_bytes, response_bytes) = HEADER.unpack_from(data, 0)
+    if version != TRACE_VERSION:
+        raise ValueError('unsupported trace version %d' % version)
+
+    offset = HEADER.size
+    path_length = data[offset]
+    offset += 1
+    path = data[offset:offset + path_length].decode('ascii')
+    offset += path_length
+
+    request_body_length, = struct.unpack_from('<H', data, offset)
+    offset += 2
+    request_body = data[offset:offset + request_body_length]
+    offset += request_body_length
+
+    response_body_length, = struct.unpack_from('<H', data, offset)
+    offset += 2
+    response_body = data[offset:offset + response_body_length]
+    offset += response_body_length
+
+    # slicing doesn't complain about a record cut off in the middle of a body
+    if offset > len(data):
+        raise ValueError('record truncated, %d of %d bytes' % (len(data), offset))
+
+    return {
+        'method': METHODS[method] if method < len(METHODS) else 'OTHER',
+        'msgpack': bool(flags & 1),
+        'error': error,
+        'start': start,
+        'latency': latency,
+        'status': status,
+        'request_bytes': request_bytes,
+        'response_bytes': response_bytes,
+        'path': path,
+        'request_body': request_body,
+        'response_body': response_body,
+    }
+
+
+def read_trace(lines):
+    """Pick the trace records out of a serial capture, ignoring log output in between."""
+    records = []
+    for line_number, line in enumerate(lines, 1):
+        marker = line.find(TRACE_MARKER)
+        if marker < 0:
+            continue
+        try:
+            records.append(parse_record(base64.b64decode(line[marker + len(TRACE_MARKER):].strip())))
+        except (ValueError, struct.error, IndexError) as e:
+            print('Skipping broken record in line %d: %s' % (line_number, e), file=sys.stderr)
+    return records
+
+
+def replay(record, connection, host):
+    """Send the recorded request again, return status, bytes on the wire and latency in ms."""
+    mimetype = MSGPACK_MIMETYPE if record['msgpack'] else 'application/json'
+    headers = {
+        'Host': host,
+        'Content-Type': mimetype,
+        'Accept': MSGPACK_MIMETYPE if record['msgpack'] else 'application/json',
+        'Cache-Control': 'no-cache',
+    }
+    # same request layout as the device, for comparable byte counts
+    request_line = '%s %s HTTP/1.1\r\n' % (record['method'], record['path'])
+    request_bytes = len(request_line) + sum(len('%s: %s\r\n' % h) for h in headers.items()) \
+        + len('Content-Length: %d\r\n\r\n' % len(record['request_body'])) + len(record['request_body'])
+
+    start = time.perf_counter()
+    connection.request(record['method'], record['path'], body=record['request_body'], headers=headers)
+    response = connection.getresponse()
+    body = response.read()
+    latency = (time.perf_counter() - start) * 1000
+
+    status_line = 'HTTP/1.1 %d %s\r\n' % (response.status, response.reason)
+    response_bytes = len(status_line) + sum(len('%s: %s\r\n' % h) for h in response.getheaders()) + 2 + len(body)
+
+    return response.status, request_bytes, response_bytes, latency
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+
+def print_report(rows):
+    print('%-24s %5s %10s %10s %9s %9s' % ('request', 'count', 'req bytes', 'resp bytes', 'p50 ms', 'p95 ms'))
+    for key, stats in sorted(rows.items()):
+        print('%-24s %5d %10d %10d %9.1f %9.1f' % (
+            key[:24], len(stats['latency']), stats['request_bytes'], stats['response_bytes'],
+            statistics.median(stats['latency']) if stats['latency'] else 0,
+            percentile(stats['latency'], 95)))
+
+
+def add_row(rows, key, request_bytes, response_bytes, latency):
+    stats = rows.setdefault(key, {'request_bytes': 0, 'response_bytes': 0, 'latency': []})
+    stats['request_bytes'] += request_bytes
+    stats['response_bytes'] += response_bytes
+    stats['latency'].append(latency)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='serial output of the device with capture mode on')
+    parser.add_argument('--backend', help='base url of the backend to replay against, e.g. http://localhost:5555')
+    parser.add_argument('--skip', action='append', default=None,
+                        help='path prefix not to replay (default: /habits/watch, long polls only measure idle time)')
+    args = parser.parse_args()
+    skip = args.skip if args.skip is not None else ['/habits/watch']
+
+    try:
+        with open(args.capture, 'r', errors='replace') as capture:
+            records = read_trace(capture)
+    except OSError as e:
+        sys.exit('Cannot read capture: %s' % e)
+
+    recorded = {}
+    for record in records:
+        key = '%s %s' % (record['method'], record['path'])
+        add_row(recorded, key, record['request_bytes'], record['response_bytes'], record['latency'])
+
+    failed = sum(1 for record in records if record['status'] == 0)
+    print('Recorded: %d requests, %d without response, %d bytes sent, %d bytes received' % (
+        len(records), failed,
+        sum(r['request_bytes'] for r in records), sum(r['response_bytes'] for r in records)))
+    print_report(recorded)
+
+    if not args.backend:
+        return
+
+    url = urllib.parse.urlsplit(args.backend)
+    if url.scheme not in ('http', 'https') or not url.hostname:
+        sys.exit('Backend must be an http(s) url like http://localhost:5555, not %s' % args.backend)
+    connection_class = http.client.HTTPSConnection if url.scheme == 'https' else http.client.HTTPConnection
+    connection = connection_class(url.hostname, url.port)
+
+    replayed = {}
+    mismatches = 0
+    skipped = 0
+    errors = 0
+    for number, record in enumerate(records, 1):
+        if any(record['path'].startswith(prefix) for prefix in skip):
+            skipped += 1
+            continue
+
+        try:
+            status, request_bytes, response_bytes, latency = replay(record, connection, url.netloc)
+        except (ConnectionRefusedError, socket.gaierror) as e:
+            sys.exit('Backend %s not reachable: %s' % (args.backend, e))
+        except (OSError, http.client.HTTPException) as e:
+            # a broken connection only fails this exchange, the next request connects again
+            print('Replaying record %d (%s %s) failed: %s' % (number, record['method'], record['path'], e), file=sys.stderr)
+            errors += 1
+            connection.close()
+            continue
+
+        if record['status'] and status != record['status']:
+            mismatches += 1
+        add_row(replayed, '%s %s' % (record['method'], record['path']), request_bytes, response_bytes, latency)
+
+    total = sum(len(stats['latency']) for stats in replayed.values())
+    print()
+    print('Replayed against %s: %d requests, %d skipped, %d failed, %d with a different status, %d bytes sent, %d bytes received' % (
+        args.backend, total, skipped, errors, mismatches,
+        sum(stats['request_bytes'] for stats in replayed.values()),
+        sum(stats['response_bytes'] for stats in replayed.values())))
+    print_report(replayed)
+
+
+if __name__ == '__main__':
+    main()